@@ -0,0 +1,18 @@
+# Load ten million strings with ih/it, then drain them with rhn
+option fail 0
+option malloc 0
+option timeout 0
+new
+time it dolphin 10000000
+time rhn 10000000
+time ih RAND 10000000
+time rhn 10000000
+free
+# Same again, handing the strings over instead of copying them
+option owned 1
+new
+time it dolphin 10000000
+time rhn 10000000
+time ih RAND 10000000
+time rhn 10000000
+free
@@ -0,0 +1,28 @@
+# Walk a scattered queue of ten million elements before and after compacting
+# it, then sort scattered queues with and without compaction after sort
+option fail 0
+option malloc 0
+option timeout 0
+new
+it RAND 10000000
+shuffle
+time reverse
+time compact
+time reverse
+free
+option compact 0
+new
+it RAND 3000000
+shuffle
+time sort
+time reverse
+time sort
+free
+option compact 1
+new
+it RAND 3000000
+shuffle
+time sort
+time reverse
+time sort
+free
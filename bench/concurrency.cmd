@@ -0,0 +1,12 @@
+# Throughput of the lock-free queue against a mutex-protected queue with
+# 1, 2, 4 and 8 producers and as many consumers, and of the ring buffer with
+# a single producer and consumer
+option timeout 0
+option concurrency 1
+stress 200000
+option concurrency 2
+stress 200000
+option concurrency 4
+stress 200000
+option concurrency 8
+stress 200000
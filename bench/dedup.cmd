@@ -0,0 +1,35 @@
+# Remove duplicated strings from one million unsorted strings, with 10%, 50%
+# and 90% of them repeating a recent string, against sorting them for dedup
+option fail 0
+option malloc 0
+option timeout 0
+option dup 10
+new
+ih RAND 1000000
+time dedupall
+free
+new
+ih RAND 1000000
+time sort
+time dedup
+free
+option dup 50
+new
+ih RAND 1000000
+time dedupall
+free
+new
+ih RAND 1000000
+time sort
+time dedup
+free
+option dup 90
+new
+ih RAND 1000000
+time dedupall
+free
+new
+ih RAND 1000000
+time sort
+time dedup
+free
@@ -0,0 +1,18 @@
+# Throughput of sort on one and on four threads for one million strings
+option fail 0
+option malloc 0
+option timeout 0
+new
+ih RAND 1000000
+time sort
+free
+option threads 4
+new
+ih RAND 1000000
+time sort
+free
+option descend 1
+new
+ih RAND 1000000
+time sort
+free
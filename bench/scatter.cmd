@@ -0,0 +1,25 @@
+# Walk queues of ten million elements whose nodes are scattered in memory:
+# shuffling leaves list order unrelated to allocation order
+option fail 0
+option malloc 0
+option timeout 0
+new
+it RAND 10000000
+shuffle
+time reverse
+time descend
+free
+new
+it RAND 10000000
+shuffle
+time free
+new
+it RAND 5000000
+shuffle
+sort
+new
+it RAND 5000000
+shuffle
+sort
+time merge
+free
@@ -0,0 +1,10 @@
+# Shuffle ten million strings, then shuffle them again once sorted
+option fail 0
+option malloc 0
+option timeout 0
+new
+ih RAND 10000000
+time shuffle
+sort
+time shuffle
+free
@@ -0,0 +1,19 @@
+# Insert throughput of malloc-backed versus slab-backed allocation.
+# A warm-up round comes first so neither side pays for fresh page faults.
+option fail 0
+option malloc 0
+new
+ih dolphin 1000000
+free
+# Every block obtained from malloc
+option slab 0
+new
+time ih dolphin 1000000
+time it gerbil 1000000
+time free
+# Small blocks carved out of slabs
+option slab 1
+new
+time ih dolphin 1000000
+time it gerbil 1000000
+time free
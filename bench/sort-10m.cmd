@@ -0,0 +1,16 @@
+# Throughput of sort, listsort and radixsort on ten million random strings
+option fail 0
+option malloc 0
+option timeout 0
+new
+ih RAND 10000000
+time sort
+free
+new
+ih RAND 10000000
+time listsort
+free
+new
+ih RAND 10000000
+time radixsort
+free
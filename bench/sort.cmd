@@ -0,0 +1,22 @@
+# Throughput of sort, listsort and radixsort on one million random strings
+option fail 0
+option malloc 0
+option timeout 0
+new
+ih RAND 1000000
+time sort
+time reverse
+time sort
+free
+new
+ih RAND 1000000
+time listsort
+time reverse
+time listsort
+free
+new
+ih RAND 1000000
+time radixsort
+time reverse
+time radixsort
+free
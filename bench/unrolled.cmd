@@ -0,0 +1,25 @@
+# Footprint and speed of four million RAND strings in a list queue, then in
+# an unrolled one
+option fail 0
+option malloc 0
+option timeout 0
+new
+time it RAND 4000000
+mem
+time sort
+time reverse
+time reverseK 3
+time swap
+time dm
+time rhn 4000000
+free
+new unrolled
+time it RAND 4000000
+mem
+time sort
+time reverse
+time reverseK 3
+time swap
+time dm
+time rhn 4000000
+free
@@ -0,0 +1,228 @@
+/* Scalar and vector kernels comparing strings of known length */
+
+#include <stdint.h>
+#include <string.h>
+
+#include "compare.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#define HAVE_X86_KERNELS 1
+#include <immintrin.h>
+#endif
+
+static inline uint64_t load64(const char *p)
+{
+    uint64_t w;
+    memcpy(&w, p, sizeof(w));
+    return w;
+}
+
+/* Offset of the first differing byte within two unequal words */
+static inline size_t word_diff(uint64_t x, uint64_t y)
+{
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    return __builtin_ctzll(x ^ y) / 8;
+#else
+    return __builtin_clzll(x ^ y) / 8;
+#endif
+}
+
+/* Strings shorter than 16 bytes.  From 8 bytes on, two words cover them,
+ * the second one overlapping the first.
+ */
+static inline size_t diff_short(const char *a, const char *b, size_t n)
+{
+    if (n < 8) {
+        for (size_t i = 0; i < n; i++) {
+            if (a[i] != b[i])
+                return i;
+        }
+        return n;
+    }
+
+    uint64_t x = load64(a), y = load64(b);
+    if (x != y)
+        return word_diff(x, y);
+    x = load64(a + n - 8);
+    y = load64(b + n - 8);
+    return x != y ? n - 8 + word_diff(x, y) : n;
+}
+
+static size_t diff_scalar(const char *a, const char *b, size_t n)
+{
+    size_t i = 0;
+    for (; i + 16 <= n; i += 16) {
+        uint64_t x0 = load64(a + i), y0 = load64(b + i);
+        uint64_t x1 = load64(a + i + 8), y1 = load64(b + i + 8);
+        if ((x0 ^ y0) | (x1 ^ y1))
+            return x0 != y0 ? i + word_diff(x0, y0)
+                            : i + 8 + word_diff(x1, y1);
+    }
+    return i + diff_short(a + i, b + i, n - i);
+}
+
+#ifdef HAVE_X86_KERNELS
+/* Mask with bit i set if byte i of the 16 bytes at a and b differs */
+__attribute__((target("sse2"))) static inline unsigned sse2_mask(
+    const char *a,
+    const char *b)
+{
+    __m128i va = _mm_loadu_si128((const __m128i *) a);
+    __m128i vb = _mm_loadu_si128((const __m128i *) b);
+    return _mm_movemask_epi8(_mm_cmpeq_epi8(va, vb)) ^ 0xffff;
+}
+
+/* Strings of 16 bytes or more, whose last 16 bytes are compared with a
+ * load overlapping the ones before
+ */
+__attribute__((target("sse2"))) static inline size_t sse2_tail(const char *a,
+                                                               const char *b,
+                                                               size_t i,
+                                                               size_t n)
+{
+    for (; i + 16 <= n; i += 16) {
+        unsigned m = sse2_mask(a + i, b + i);
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+    if (i == n)
+        return n;
+    unsigned m = sse2_mask(a + n - 16, b + n - 16);
+    return m ? n - 16 + __builtin_ctz(m) : n;
+}
+
+__attribute__((target("sse2"))) static size_t diff_sse2(const char *a,
+                                                        const char *b,
+                                                        size_t n)
+{
+    if (n < 16)
+        return diff_short(a, b, n);
+
+    /* A cache line per iteration, with a single branch on all of it */
+    size_t i = 0;
+    for (; i + 64 <= n; i += 64) {
+        __m128i e0 = _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i)),
+                                    _mm_loadu_si128((const __m128i *) (b + i)));
+        __m128i e1 =
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i + 16)),
+                           _mm_loadu_si128((const __m128i *) (b + i + 16)));
+        __m128i e2 =
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i + 32)),
+                           _mm_loadu_si128((const __m128i *) (b + i + 32)));
+        __m128i e3 =
+            _mm_cmpeq_epi8(_mm_loadu_si128((const __m128i *) (a + i + 48)),
+                           _mm_loadu_si128((const __m128i *) (b + i + 48)));
+        __m128i all =
+            _mm_and_si128(_mm_and_si128(e0, e1), _mm_and_si128(e2, e3));
+        if (_mm_movemask_epi8(all) != 0xffff)
+            break;
+    }
+    return sse2_tail(a, b, i, n);
+}
+
+/* Mask with bit i set if byte i of the 32 bytes at a and b differs */
+__attribute__((target("avx2"))) static inline unsigned avx2_mask(
+    const char *a,
+    const char *b)
+{
+    __m256i va = _mm256_loadu_si256((const __m256i *) a);
+    __m256i vb = _mm256_loadu_si256((const __m256i *) b);
+    return ~(unsigned) _mm256_movemask_epi8(_mm256_cmpeq_epi8(va, vb));
+}
+
+__attribute__((target("avx2"))) static size_t diff_avx2(const char *a,
+                                                        const char *b,
+                                                        size_t n)
+{
+    if (n < 16)
+        return diff_short(a, b, n);
+    if (n < 32)
+        return sse2_tail(a, b, 0, n);
+
+    /* Two cache lines per iteration, with a single branch on all of them */
+    size_t i = 0;
+    for (; i + 128 <= n; i += 128) {
+        __m256i e0 = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *) (a + i)),
+            _mm256_loadu_si256((const __m256i *) (b + i)));
+        __m256i e1 = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *) (a + i + 32)),
+            _mm256_loadu_si256((const __m256i *) (b + i + 32)));
+        __m256i e2 = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *) (a + i + 64)),
+            _mm256_loadu_si256((const __m256i *) (b + i + 64)));
+        __m256i e3 = _mm256_cmpeq_epi8(
+            _mm256_loadu_si256((const __m256i *) (a + i + 96)),
+            _mm256_loadu_si256((const __m256i *) (b + i + 96)));
+        __m256i all = _mm256_and_si256(_mm256_and_si256(e0, e1),
+                                       _mm256_and_si256(e2, e3));
+        if ((unsigned) _mm256_movemask_epi8(all) != 0xffffffff)
+            break;
+    }
+    for (; i + 32 <= n; i += 32) {
+        unsigned m = avx2_mask(a + i, b + i);
+        if (m)
+            return i + __builtin_ctz(m);
+    }
+    if (i == n)
+        return n;
+    unsigned m = avx2_mask(a + n - 32, b + n - 32);
+    return m ? n - 32 + __builtin_ctz(m) : n;
+}
+#endif
+
+static bool kernel_supported(compare_kernel_t k)
+{
+    switch (k) {
+    case COMPARE_SCALAR:
+        return true;
+#ifdef HAVE_X86_KERNELS
+    case COMPARE_SSE2:
+        return __builtin_cpu_supports("sse2");
+    case COMPARE_AVX2:
+        return __builtin_cpu_supports("avx2");
+#endif
+    default:
+        return false;
+    }
+}
+
+compare_func_t compare_diff = diff_scalar;
+
+bool compare_select(compare_kernel_t k)
+{
+    if (k == COMPARE_AUTO) {
+        for (k = COMPARE_NR_KERNELS - 1; !kernel_supported(k); k--)
+            ;
+    }
+    if (!kernel_supported(k))
+        return false;
+
+    switch (k) {
+#ifdef HAVE_X86_KERNELS
+    case COMPARE_SSE2:
+        compare_diff = diff_sse2;
+        break;
+    case COMPARE_AVX2:
+        compare_diff = diff_avx2;
+        break;
+#endif
+    default:
+        compare_diff = diff_scalar;
+        break;
+    }
+    return true;
+}
+
+const char *compare_name(compare_kernel_t k)
+{
+    static const char *names[] = {"auto", "scalar", "SSE2", "AVX2"};
+    return k < COMPARE_NR_KERNELS ? names[k] : "unknown";
+}
+
+/* Pick the best kernel before any comparison may run */
+__attribute__((constructor)) static void compare_init(void)
+{
+    __builtin_cpu_init();
+    compare_select(COMPARE_AUTO);
+}
@@ -0,0 +1,58 @@
+#ifndef LAB0_COMPARE_H
+#define LAB0_COMPARE_H
+
+/* Kernels locating the first difference between two strings of known
+ * length, used by every comparison of queue elements.
+ *
+ * The kernels only read the n bytes they are given, so vector loads never
+ * cross into a page the strings do not occupy.  The best kernel the CPU
+ * supports is selected at startup; compare_select() may switch to another
+ * one, e.g. to measure them against each other.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef enum {
+    COMPARE_AUTO,   /* Best kernel supported by the CPU */
+    COMPARE_SCALAR, /* Portable, eight bytes at a time */
+    COMPARE_SSE2,   /* 16 bytes at a time */
+    COMPARE_AVX2,   /* 32 bytes at a time */
+    COMPARE_NR_KERNELS,
+} compare_kernel_t;
+
+/* Return the index of the first byte where a and b differ, or n if their
+ * first n bytes are equal
+ */
+typedef size_t (*compare_func_t)(const char *a, const char *b, size_t n);
+
+/* Kernel in use, never NULL */
+extern compare_func_t compare_diff;
+
+/* Switch to kernel k.  Return false, keeping the current kernel, if k is
+ * unknown or not supported by the CPU.  Must not be called while another
+ * thread compares elements.
+ */
+bool compare_select(compare_kernel_t k);
+
+/* Name of kernel k */
+const char *compare_name(compare_kernel_t k);
+
+/* Compare a string of length la with one of length lb the way strcmp()
+ * does
+ */
+static inline int compare_strings(const char *a,
+                                  size_t la,
+                                  const char *b,
+                                  size_t lb)
+{
+    size_t n = la < lb ? la : lb;
+    /* Most strings differ at once, which needs no call into a kernel */
+    size_t i = n && *a != *b ? 0 : compare_diff(a, b, n);
+    if (i < n)
+        return (unsigned char) a[i] - (unsigned char) b[i];
+    /* A proper prefix sorts first */
+    return (la > lb) - (la < lb);
+}
+
+#endif /* LAB0_COMPARE_H */
@@ -13,6 +13,7 @@
 
 #include "console.h"
 #include "report.h"
+#include "rio.h"
 #include "web.h"
 
 /* Some global values */
@@ -34,16 +35,14 @@ static double first_time, last_time;
  */
 
 #define RIO_BUFSIZE 8192
+#define RIO_MAXSIZE (1 << 20)
 
-typedef struct __rio {
-    int fd;                /* File descriptor */
-    int count;             /* Unread bytes in internal buffer */
-    char *bufptr;          /* Next unread byte in internal buffer */
-    char buf[RIO_BUFSIZE]; /* Internal buffer */
-    struct __rio *prev;    /* Next element in stack */
-} rio_t;
+typedef struct __input {
+    rio_t rio;             /* Buffered input */
+    struct __input *prev;  /* Next element in stack */
+} input_t;
 
-static rio_t *buf_stack;
+static input_t *buf_stack;
 static char linebuf[RIO_BUFSIZE];
 
 /* Maximum file descriptor */
@@ -391,18 +390,49 @@ static bool do_time(int argc, char *argv[])
     return ok;
 }
 
+/* Run a command that has to fail, so that a trace can check rejected input */
+static bool do_mustfail(int argc, char *argv[])
+{
+    if (argc <= 1) {
+        report(1, "%s needs a command to run", argv[0]);
+        return false;
+    }
+
+    cmd_element_t *next_cmd = cmd_list;
+    while (next_cmd && strcmp(argv[1], next_cmd->name) != 0)
+        next_cmd = next_cmd->next;
+    if (!next_cmd) {
+        report(1, "Unknown command '%s'", argv[1]);
+        return false;
+    }
+    if (next_cmd->operation(argc - 1, argv + 1)) {
+        report(1, "ERROR: %s was expected to fail", argv[1]);
+        return false;
+    }
+    return true;
+}
+
 static bool use_linenoise = true;
-static int web_fd;
+static int web_fd = -1;
 
 static bool do_web(int argc, char *argv[])
 {
-    int port = 9999;
-    if (argc == 2) {
+    if (web_fd != -1) {
+        report(1, "Web server already listening, fd is %d", web_fd);
+        return false;
+    }
+
+    int port = 9999, nthreads = 0;
+    if (argc >= 2) {
         if (argv[1][0] >= '0' && argv[1][0] <= '9')
             port = atoi(argv[1]);
     }
+    if (argc >= 3 && !get_int(argv[2], &nthreads)) {
+        report(1, "Invalid number of workers '%s'", argv[2]);
+        return false;
+    }
 
-    web_fd = web_open(port);
+    web_fd = web_open(port, nthreads);
     if (web_fd > 0) {
         printf("listen on port %d, fd is %d\n", port, web_fd);
         use_linenoise = false;
@@ -429,7 +459,9 @@ void init_cmd()
     ADD_COMMAND(source, "Read commands from source file", "");
     ADD_COMMAND(log, "Copy output to file", "file");
     ADD_COMMAND(time, "Time command execution", "cmd arg ...");
-    ADD_COMMAND(web, "Read commands from builtin web server", "[port]");
+    ADD_COMMAND(mustfail, "Run command that has to fail", "cmd arg ...");
+    ADD_COMMAND(web, "Read commands from builtin web server",
+                "[port] [workers]");
     add_cmd("#", do_comment_cmd, "Display comment", "...");
     add_param("simulation", &simulation, "Start/Stop simulation mode", NULL);
     add_param("verbose", &verblevel, "Verbosity level", NULL);
@@ -456,10 +488,13 @@ static bool push_file(char *fname)
     if (fd > fd_max)
         fd_max = fd;
 
-    rio_t *rnew = malloc_or_fail(sizeof(rio_t), "push_file");
-    rnew->fd = fd;
-    rnew->count = 0;
-    rnew->bufptr = rnew->buf;
+    input_t *rnew = malloc_or_fail(sizeof(input_t), "push_file");
+    if (!rio_init(&rnew->rio, fd, RIO_BUFSIZE, RIO_MAXSIZE)) {
+        free_block(rnew, sizeof(input_t));
+        if (fname)
+            close(fd);
+        return false;
+    }
     rnew->prev = buf_stack;
     buf_stack = rnew;
 
@@ -470,10 +505,11 @@ static bool push_file(char *fname)
 static void pop_file()
 {
     if (buf_stack) {
-        rio_t *rsave = buf_stack;
+        input_t *rsave = buf_stack;
         buf_stack = rsave->prev;
-        close(rsave->fd);
-        free_block(rsave, sizeof(rio_t));
+        close(rsave->rio.fd);
+        rio_free(&rsave->rio);
+        free_block(rsave, sizeof(input_t));
     }
 }
 
@@ -488,48 +524,36 @@ static void init_in()
  */
 static char *readline()
 {
-    char c;
-    char *lptr = linebuf;
-
     if (!buf_stack)
         return NULL;
 
-    for (int cnt = 0; cnt < RIO_BUFSIZE - 2; cnt++) {
-        if (buf_stack->count <= 0) {
-            /* Need to read from input file */
-            buf_stack->count = read(buf_stack->fd, buf_stack->buf, RIO_BUFSIZE);
-            buf_stack->bufptr = buf_stack->buf;
-            if (buf_stack->count <= 0) {
-                /* Encountered EOF */
+    rio_t *rp = &buf_stack->rio;
+    size_t len;
+    char *line;
+    bool eof = false;
+    /* Lines too long for linebuf are cut, the rest makes another line */
+    while (!(line = rio_getline(rp, RIO_BUFSIZE - 2, &len))) {
+        if (rio_fill(rp) <= 0) {
+            /* Encountered EOF */
+            line = rio_getrest(rp, &len);
+            if (len == 0) {
                 pop_file();
-                if (cnt > 0) {
-                    /* Last line of file did not terminate with newline. */
-                    /*  Terminate line & return it */
-                    *lptr++ = '\n';
-                    *lptr++ = '\0';
-                    if (echo) {
-                        report_noreturn(1, prompt);
-                        report_noreturn(1, linebuf);
-                    }
-                    return linebuf;
-                }
                 return NULL;
             }
-        }
-
-        /* Have text in buffer */
-        c = *buf_stack->bufptr++;
-        *lptr++ = c;
-        buf_stack->count--;
-        if (c == '\n')
+            /* Last line of file did not terminate with newline. */
+            eof = true;
             break;
+        }
     }
 
-    if (c != '\n') {
-        /* Hit buffer limit.  Artificially terminate line */
-        *lptr++ = '\n';
+    memcpy(linebuf, line, len);
+    if (eof)
+        pop_file();
+    if (linebuf[len - 1] != '\n') {
+        /* Hit buffer limit or EOF.  Artificially terminate line */
+        linebuf[len++] = '\n';
     }
-    *lptr++ = '\0';
+    linebuf[len] = '\0';
 
     if (echo) {
         report_noreturn(1, prompt);
@@ -544,6 +568,43 @@ static bool cmd_done()
     return !buf_stack || quit_flag;
 }
 
+/* Main control loop step once the web server runs.  Wait until commands
+ * arrive from web clients, whose connections the web workers serve, or
+ * from command input, then run them.
+ * Commands of web clients run one at a time, in the order they came in, so
+ * that they see the queue the way a single console would.
+ */
+static int web_select()
+{
+    static bool prompted;
+    int infd = buf_stack->rio.fd;
+    if (infd == STDIN_FILENO && prompt_flag && !prompted) {
+        printf("%s", prompt);
+        fflush(stdout);
+        prompted = true;
+    }
+
+    int result = 0;
+    bool in_ready = web_poll(infd, -1);
+    char *cmd;
+    while (!cmd_done() && (cmd = web_next_cmd())) {
+        interpret_cmd(cmd);
+        web_finish();
+        result++;
+    }
+
+    if (in_ready && !cmd_done()) {
+        /* Commandline input available */
+        prompted = false;
+        set_echo(0);
+        char *cmdline = readline();
+        if (cmdline)
+            interpret_cmd(cmdline);
+        result++;
+    }
+    return result;
+}
+
 /* Handle command processing in program that uses select as main control loop.
  * Like select, but checks whether command input either present in internal
  * buffer
@@ -553,7 +614,6 @@ static bool cmd_done()
  * nfds should be set to the maximum file descriptor for network sockets.
  * If nfds == 0, this indicates that there is no pending network activity
  */
-int web_connfd;
 static int cmd_select(int nfds,
                       fd_set *readfds,
                       fd_set *writefds,
@@ -566,20 +626,19 @@ static int cmd_select(int nfds,
     if (cmd_done())
         return 0;
 
+    if (web_fd != -1 && !block_flag)
+        return web_select();
+
     if (!block_flag) {
         /* Process any commands in input buffer */
         if (!readfds)
             readfds = &local_readset;
 
         /* Add input fd to readset for select */
-        infd = buf_stack->fd;
+        infd = buf_stack->rio.fd;
         FD_ZERO(readfds);
         FD_SET(infd, readfds);
 
-        /* If web not ready listen */
-        if (web_fd != -1)
-            FD_SET(web_fd, readfds);
-
         if (infd == STDIN_FILENO && prompt_flag) {
             printf("%s", prompt);
             fflush(stdout);
@@ -588,8 +647,6 @@ static int cmd_select(int nfds,
 
         if (infd >= nfds)
             nfds = infd + 1;
-        if (web_fd >= nfds)
-            nfds = web_fd + 1;
     }
     if (nfds == 0)
         return 0;
@@ -598,7 +655,7 @@ static int cmd_select(int nfds,
     if (result <= 0)
         return result;
 
-    infd = buf_stack->fd;
+    infd = buf_stack->rio.fd;
     if (readfds && FD_ISSET(infd, readfds)) {
         /* Commandline input available */
         FD_CLR(infd, readfds);
@@ -608,22 +665,6 @@ static int cmd_select(int nfds,
         char *cmdline = readline();
         if (cmdline)
             interpret_cmd(cmdline);
-    } else if (readfds && FD_ISSET(web_fd, readfds)) {
-        FD_CLR(web_fd, readfds);
-        result--;
-        struct sockaddr_in clientaddr;
-        socklen_t clientlen = sizeof(clientaddr);
-        web_connfd =
-            accept(web_fd, (struct sockaddr *) &clientaddr, &clientlen);
-
-        char *p = web_recv(web_connfd, &clientaddr);
-        char *buffer = "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\n\r\n";
-        web_send(web_connfd, buffer);
-
-        if (p)
-            interpret_cmd(p);
-        free(p);
-        close(web_connfd);
     }
     return result;
 }
@@ -692,7 +733,7 @@ bool run_console(char *infile_name)
             line_history_add(cmdline);       /* Add to the history. */
             line_history_save(HISTORY_FILE); /* Save the history on disk. */
             line_free(cmdline);
-            while (buf_stack && buf_stack->fd != STDIN_FILENO)
+            while (buf_stack && buf_stack->rio.fd != STDIN_FILENO)
                 cmd_select(0, NULL, NULL, NULL, NULL);
             has_infile = false;
         }
@@ -0,0 +1,345 @@
+/* Lock-free multi-producer multi-consumer queue of elements */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "cqueue.h"
+#include "element.h"
+
+/* Hazard pointers used by one operation: the head or tail, and its next */
+#define HP_PER_RECORD 2
+
+/* Retired nodes a record collects before looking for reclaimable ones */
+#define HP_SCAN_THRESHOLD 64
+
+typedef struct __cq_node {
+    _Atomic(struct __cq_node *) next;
+    element_t *elem;
+    struct __cq_node *retired_next; /* Link in the retired list of a record */
+    _Atomic uint32_t free_next;     /* Link in the free stack of the pool */
+} cq_node_t;
+
+/**
+ * hp_record_t - Hazard pointers and retired nodes of one operation
+ * @hp: nodes the owner may dereference, which nobody else may free
+ * @active: whether an operation currently owns the record
+ * @next: next record of the queue, fixed once the record is published
+ * @retired: nodes unlinked by past owners and not freed yet
+ * @nretired: length of @retired
+ *
+ * Records are never released before the queue itself.  An operation claims
+ * any inactive record, so the number of records is bounded by the number of
+ * operations that ever ran at the same time.
+ */
+typedef struct __hp_record {
+    _Atomic(cq_node_t *) hp[HP_PER_RECORD];
+    atomic_bool active;
+    struct __hp_record *next;
+    cq_node_t *retired;
+    size_t nretired;
+} hp_record_t;
+
+struct __cqueue {
+    /* Kept on separate cache lines, since producers and consumers each
+     * hammer one of them.
+     */
+    _Atomic(cq_node_t *) head __attribute__((aligned(64)));
+    _Atomic(cq_node_t *) tail __attribute__((aligned(64)));
+    _Atomic(hp_record_t *) records __attribute__((aligned(64)));
+    /* Free stack of the pool: a tag bumped by every change in the high
+     * half, so that a stale top fails its compare-and-swap, and 1 + the
+     * index of the top node in the low half, 0 if the stack is empty
+     */
+    _Atomic uint64_t free_top __attribute__((aligned(64)));
+    cq_node_t *pool;
+    size_t pool_size;
+    uint64_t id;
+};
+
+/* Source of cqueue_t.id, which tells queues apart even at the same address */
+static _Atomic uint64_t cq_next_id = 1;
+
+/* Record last claimed by this thread, tried first on the same queue */
+static __thread struct {
+    uint64_t id;
+    hp_record_t *rec;
+} hp_hint;
+
+/* Take a node from the pool, or from the allocator once the pool is empty */
+static cq_node_t *node_alloc(cqueue_t *cq)
+{
+    uint64_t top = atomic_load(&cq->free_top);
+    while ((uint32_t) top) {
+        cq_node_t *node = &cq->pool[(uint32_t) top - 1];
+        uint64_t next =
+            (((top >> 32) + 1) << 32) |
+            atomic_load_explicit(&node->free_next, memory_order_relaxed);
+        if (atomic_compare_exchange_weak(&cq->free_top, &top, next))
+            return node;
+    }
+    return malloc(sizeof(cq_node_t));
+}
+
+static void node_free(cqueue_t *cq, cq_node_t *node)
+{
+    if (node < cq->pool || node >= cq->pool + cq->pool_size) {
+        free(node);
+        return;
+    }
+
+    uint64_t top = atomic_load(&cq->free_top);
+    uint64_t index = node - cq->pool + 1;
+    do {
+        atomic_store_explicit(&node->free_next, (uint32_t) top,
+                              memory_order_relaxed);
+    } while (!atomic_compare_exchange_weak(
+        &cq->free_top, &top, (((top >> 32) + 1) << 32) | index));
+}
+
+static hp_record_t *hp_acquire(cqueue_t *cq)
+{
+    hp_record_t *rec = hp_hint.id == cq->id ? hp_hint.rec : NULL;
+    if (rec && !atomic_load_explicit(&rec->active, memory_order_relaxed) &&
+        !atomic_exchange(&rec->active, true))
+        return rec;
+
+    for (rec = atomic_load(&cq->records); rec; rec = rec->next) {
+        if (!atomic_load_explicit(&rec->active, memory_order_relaxed) &&
+            !atomic_exchange(&rec->active, true))
+            goto found;
+    }
+
+    rec = malloc(sizeof(hp_record_t));
+    if (!rec)
+        return NULL;
+    for (int i = 0; i < HP_PER_RECORD; i++)
+        atomic_init(&rec->hp[i], NULL);
+    atomic_init(&rec->active, true);
+    rec->retired = NULL;
+    rec->nretired = 0;
+    rec->next = atomic_load(&cq->records);
+    while (!atomic_compare_exchange_weak(&cq->records, &rec->next, rec))
+        ;
+
+found:
+    hp_hint.id = cq->id;
+    hp_hint.rec = rec;
+    return rec;
+}
+
+static void hp_release(hp_record_t *rec)
+{
+    for (int i = 0; i < HP_PER_RECORD; i++)
+        atomic_store_explicit(&rec->hp[i], NULL, memory_order_release);
+    atomic_store_explicit(&rec->active, false, memory_order_release);
+}
+
+/* Publish node in hazard pointer slot i, then check it is still reachable
+ * from src.  Return the node, or NULL if src changed in the meantime.
+ */
+static cq_node_t *hp_protect(hp_record_t *rec,
+                             int i,
+                             _Atomic(cq_node_t *) *src,
+                             cq_node_t *node)
+{
+    atomic_store(&rec->hp[i], node);
+    return atomic_load(src) == node ? node : NULL;
+}
+
+static bool hp_is_protected(cqueue_t *cq, const cq_node_t *node)
+{
+    for (hp_record_t *r = atomic_load(&cq->records); r; r = r->next) {
+        for (int i = 0; i < HP_PER_RECORD; i++) {
+            if (atomic_load(&r->hp[i]) == node)
+                return true;
+        }
+    }
+    return false;
+}
+
+/* Free every retired node of rec that no hazard pointer refers to */
+static void hp_scan(cqueue_t *cq, hp_record_t *rec)
+{
+    cq_node_t *node = rec->retired;
+    rec->retired = NULL;
+    rec->nretired = 0;
+
+    while (node) {
+        cq_node_t *next = node->retired_next;
+        if (hp_is_protected(cq, node)) {
+            node->retired_next = rec->retired;
+            rec->retired = node;
+            rec->nretired++;
+        } else {
+            node_free(cq, node);
+        }
+        node = next;
+    }
+}
+
+static void hp_retire(cqueue_t *cq, hp_record_t *rec, cq_node_t *node)
+{
+    node->retired_next = rec->retired;
+    rec->retired = node;
+    if (++rec->nretired >= HP_SCAN_THRESHOLD)
+        hp_scan(cq, rec);
+}
+
+cqueue_t *cq_new(size_t reserve)
+{
+    if (reserve > UINT32_MAX)
+        reserve = UINT32_MAX;
+    cqueue_t *cq = malloc(sizeof(cqueue_t));
+    cq_node_t *pool = reserve ? malloc(reserve * sizeof(cq_node_t)) : NULL;
+    if (!cq || (reserve && !pool)) {
+        free(cq);
+        free(pool);
+        return NULL;
+    }
+
+    /* The free stack starts with the nodes in address order */
+    for (size_t i = 0; i < reserve; i++)
+        atomic_init(&pool[i].free_next, i + 1 < reserve ? i + 2 : 0);
+    atomic_init(&cq->free_top, reserve ? 1 : 0);
+    cq->pool = pool;
+    cq->pool_size = reserve;
+
+    cq_node_t *dummy = node_alloc(cq);
+    if (!dummy) {
+        free(pool);
+        free(cq);
+        return NULL;
+    }
+    atomic_init(&dummy->next, NULL);
+    dummy->elem = NULL;
+    atomic_init(&cq->head, dummy);
+    atomic_init(&cq->tail, dummy);
+    atomic_init(&cq->records, NULL);
+    cq->id = atomic_fetch_add(&cq_next_id, 1);
+    return cq;
+}
+
+void cq_free(cqueue_t *cq)
+{
+    if (!cq)
+        return;
+
+    /* The head is a dummy whose element, if any, was handed out already */
+    cq_node_t *node = atomic_load(&cq->head);
+    cq_node_t *next = atomic_load(&node->next);
+    node_free(cq, node);
+    for (node = next; node; node = next) {
+        next = atomic_load(&node->next);
+        q_release_element(node->elem);
+        node_free(cq, node);
+    }
+
+    hp_record_t *rec = atomic_load(&cq->records);
+    while (rec) {
+        hp_record_t *rnext = rec->next;
+        for (node = rec->retired; node; node = next) {
+            next = node->retired_next;
+            node_free(cq, node);
+        }
+        free(rec);
+        rec = rnext;
+    }
+    free(cq->pool);
+    free(cq);
+}
+
+bool cq_insert_tail(cqueue_t *cq, char *s)
+{
+    if (!cq)
+        return false;
+
+    element_t *elem = element_new(s);
+    if (!elem)
+        return false;
+    if (!cq_push(cq, elem)) {
+        q_release_element(elem);
+        return false;
+    }
+    return true;
+}
+
+bool cq_push(cqueue_t *cq, element_t *elem)
+{
+    if (!cq)
+        return false;
+
+    cq_node_t *node = node_alloc(cq);
+    hp_record_t *rec = node ? hp_acquire(cq) : NULL;
+    if (!rec) {
+        if (node)
+            node_free(cq, node);
+        return false;
+    }
+    atomic_init(&node->next, NULL);
+    node->elem = elem;
+
+    cq_node_t *tail;
+    for (;;) {
+        tail = hp_protect(rec, 0, &cq->tail, atomic_load(&cq->tail));
+        if (!tail)
+            continue;
+        cq_node_t *next = atomic_load(&tail->next);
+        if (next) {
+            /* Help a stalled insertion move the tail forward */
+            atomic_compare_exchange_weak(&cq->tail, &tail, next);
+            continue;
+        }
+        if (atomic_compare_exchange_weak(&tail->next, &next, node))
+            break;
+    }
+    /* Failing is fine, someone else has already moved the tail on */
+    atomic_compare_exchange_strong(&cq->tail, &tail, node);
+
+    hp_release(rec);
+    return true;
+}
+
+element_t *cq_remove_head(cqueue_t *cq, char *sp, size_t bufsize)
+{
+    if (!cq)
+        return NULL;
+
+    hp_record_t *rec = hp_acquire(cq);
+    if (!rec)
+        return NULL;
+
+    cq_node_t *head;
+    element_t *elem;
+    for (;;) {
+        head = hp_protect(rec, 0, &cq->head, atomic_load(&cq->head));
+        if (!head)
+            continue;
+        cq_node_t *tail = atomic_load(&cq->tail);
+        cq_node_t *next = atomic_load(&head->next);
+        if (!next) {
+            hp_release(rec);
+            return NULL;
+        }
+        /* The head still being current proves next was not freed yet */
+        atomic_store(&rec->hp[1], next);
+        if (atomic_load(&cq->head) != head)
+            continue;
+        if (head == tail) {
+            atomic_compare_exchange_weak(&cq->tail, &tail, next);
+            continue;
+        }
+        elem = next->elem;
+        if (atomic_compare_exchange_weak(&cq->head, &head, next))
+            break;
+    }
+
+    /* next is the new dummy; the old one can go once nobody looks at it */
+    hp_retire(cq, rec, head);
+    hp_release(rec);
+
+    if (sp)
+        element_copy(elem, sp, bufsize);
+    return elem;
+}
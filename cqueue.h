@@ -0,0 +1,52 @@
+#ifndef LAB0_CQUEUE_H
+#define LAB0_CQUEUE_H
+
+/* A lock-free queue of elements that any number of threads may insert into
+ * and remove from at the same time (Michael and Scott, "Simple, Fast, and
+ * Practical Non-Blocking and Blocking Concurrent Queue Algorithms", 1996).
+ *
+ * Nodes unlinked by a removal are reclaimed with hazard pointers (Michael,
+ * "Hazard Pointers: Safe Memory Reclamation for Lock-Free Objects", 2004),
+ * so no thread ever touches a node after it has been freed.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+typedef struct __cqueue cqueue_t;
+
+/* Create an empty queue with reserve nodes set aside.  These are recycled
+ * through a lock-free stack, so that operations need no allocator until
+ * more than reserve elements are in the queue at once.  Return NULL if could
+ * not allocate space.
+ */
+cqueue_t *cq_new(size_t reserve);
+
+/* Free a queue and every element still in it.  No other thread may be using
+ * the queue any more.
+ */
+void cq_free(cqueue_t *cq);
+
+/* Insert a copy of s at the tail, like q_insert_tail().
+ * Return false if cq is NULL or could not allocate space.
+ */
+bool cq_insert_tail(cqueue_t *cq, char *s);
+
+/* Insert elem, which the queue takes over, at the tail.  Only a node is
+ * allocated, if the reserve is exhausted.  Return false if cq is NULL or
+ * could not allocate space, leaving elem to the caller.
+ */
+bool cq_push(cqueue_t *cq, element_t *elem);
+
+/* Remove the element at the head, like q_remove_head().  If sp is non-NULL,
+ * copy the removed string to *sp, up to bufsize - 1 characters plus a null
+ * terminator.  Return NULL if the queue is NULL or empty.
+ *
+ * The element is released with q_release_element(); its list field is left
+ * unspecified.
+ */
+element_t *cq_remove_head(cqueue_t *cq, char *sp, size_t bufsize);
+
+#endif /* LAB0_CQUEUE_H */
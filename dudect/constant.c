@@ -6,6 +6,7 @@
 #include "cpucycles.h"
 #include "queue.h"
 #include "random.h"
+#include "ring.h"
 
 /* Maintain a queue independent from the qtest since
  * we do not want the test to affect the original functionality
@@ -36,6 +37,21 @@ static struct list_head *l = NULL;
 
 #define dut_free() ((void) (q_free(l)))
 
+/* Ring used for the ring buffer backend, large enough for any input */
+static ring_t *r = NULL;
+#define RING_DUT_CAPACITY 16384
+
+#define dut_ring_new() ((void) (r = ring_new(RING_DUT_CAPACITY)))
+
+#define dut_ring_insert_tail(s, n)    \
+    do {                              \
+        int j = n;                    \
+        while (j--)                   \
+            ring_insert_tail(r, s);   \
+    } while (0)
+
+#define dut_ring_free() ((void) (ring_free(r)))
+
 static char random_string[N_MEASURES][8];
 static int random_string_iter = 0;
 
@@ -43,6 +59,7 @@ static int random_string_iter = 0;
 void init_dut(void)
 {
     l = NULL;
+    r = NULL;
 }
 
 static char *get_random_string(void)
@@ -73,7 +90,9 @@ bool measure(int64_t *before_ticks,
              int mode)
 {
     assert(mode == DUT(insert_head) || mode == DUT(insert_tail) ||
-           mode == DUT(remove_head) || mode == DUT(remove_tail));
+           mode == DUT(remove_head) || mode == DUT(remove_tail) ||
+           mode == DUT(ring_insert_head) || mode == DUT(ring_insert_tail) ||
+           mode == DUT(ring_remove_head) || mode == DUT(ring_remove_tail));
 
     switch (mode) {
     case DUT(insert_head):
@@ -146,6 +165,48 @@ bool measure(int64_t *before_ticks,
                 return false;
         }
         break;
+    case DUT(ring_insert_head):
+    case DUT(ring_insert_tail):
+        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
+            char *s = get_random_string();
+            dut_ring_new();
+            dut_ring_insert_tail(
+                get_random_string(),
+                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000);
+            size_t before_size = ring_size(r);
+            before_ticks[i] = cpucycles();
+            if (mode == DUT(ring_insert_head))
+                ring_insert_head(r, s);
+            else
+                ring_insert_tail(r, s);
+            after_ticks[i] = cpucycles();
+            size_t after_size = ring_size(r);
+            dut_ring_free();
+            if (before_size != after_size - 1)
+                return false;
+        }
+        break;
+    case DUT(ring_remove_head):
+    case DUT(ring_remove_tail):
+        for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
+            dut_ring_new();
+            dut_ring_insert_tail(
+                get_random_string(),
+                *(uint16_t *) (input_data + i * CHUNK_SIZE) % 10000 + 1);
+            size_t before_size = ring_size(r);
+            before_ticks[i] = cpucycles();
+            element_t *e = mode == DUT(ring_remove_head)
+                               ? ring_remove_head(r, NULL, 0)
+                               : ring_remove_tail(r, NULL, 0);
+            after_ticks[i] = cpucycles();
+            size_t after_size = ring_size(r);
+            if (e)
+                q_release_element(e);
+            dut_ring_free();
+            if (before_size != after_size + 1)
+                return false;
+        }
+        break;
     default:
         for (size_t i = DROP_SIZE; i < N_MEASURES - DROP_SIZE; i++) {
             dut_new();
@@ -16,7 +16,11 @@
     _(insert_head) \
     _(insert_tail) \
     _(remove_head) \
-    _(remove_tail)
+    _(remove_tail) \
+    _(ring_insert_head) \
+    _(ring_insert_tail) \
+    _(ring_remove_head) \
+    _(ring_remove_tail)
 
 #define DUT(x) DUT_##x
 
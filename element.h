@@ -0,0 +1,168 @@
+#ifndef LAB0_ELEMENT_H
+#define LAB0_ELEMENT_H
+
+/* Layout of the elements allocated by queue.c.
+ *
+ * Each element handed out by queue.c is a qelement_t whose first member is
+ * the element_t seen by its callers.  q_release_element() passes the
+ * element_t pointer to test_free(), which therefore releases the whole
+ * block, extra fields included.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+
+#include "compare.h"
+#include "queue.h"
+
+#ifdef INLINE_KEY
+/* How many leading bytes of each string are kept next to its list node */
+#define INLINE_KEY_LEN 16
+#endif
+
+/**
+ * qelement_t - Element together with the bookkeeping kept by queue.c
+ * @base: the element_t visible through queue.h
+ * @len: strlen() of @base.value, recorded when the element is created
+ * @key: first INLINE_KEY_LEN bytes of @base.value, zero padded
+ *
+ * @len lets comparisons run on memcmp(), tells unequal strings apart
+ * without reading them, and bounds the copy made on removal.
+ *
+ * With INLINE_KEY defined, comparisons are decided on @key whenever the two
+ * strings differ within their first INLINE_KEY_LEN bytes or are shorter than
+ * that, so the heap string is only touched for long common prefixes.
+ */
+typedef struct {
+    element_t base;
+    size_t len;
+#ifdef INLINE_KEY
+    char key[INLINE_KEY_LEN];
+#endif
+} qelement_t;
+
+static inline qelement_t *to_qelement(const element_t *e)
+{
+    return (qelement_t *) e;
+}
+
+#ifdef INLINE_KEY
+/* Load 8 key bytes so that integer order matches byte order */
+static inline uint64_t key_word(const char *key)
+{
+    uint64_t w;
+    memcpy(&w, key, sizeof(w));
+#if __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+    w = __builtin_bswap64(w);
+#endif
+    return w;
+}
+#endif
+
+/* Length of the string of e */
+static inline size_t element_len(const element_t *e)
+{
+    return to_qelement(e)->len;
+}
+
+/* Fill in the fields derived from the string once value has been set */
+static inline void element_init_key(element_t *e, size_t len)
+{
+    to_qelement(e)->len = len;
+#ifdef INLINE_KEY
+    strncpy(to_qelement(e)->key, e->value, INLINE_KEY_LEN);
+#endif
+}
+
+/* Allocate an element holding a copy of s, NULL on failure */
+static inline element_t *element_new(const char *s)
+{
+    size_t len = strlen(s);
+    element_t *new = malloc(sizeof(qelement_t));
+    char *tmp = malloc(len + 1);
+    if (!new || !tmp) {
+        free(new);
+        free(tmp);
+        return NULL;
+    }
+
+    new->value = memcpy(tmp, s, len + 1);
+    element_init_key(new, len);
+    return new;
+}
+
+/* Allocate an element taking over s, which must come from malloc() or
+ * strdup().  Return NULL on failure, leaving s to the caller.
+ */
+static inline element_t *element_adopt(char *s)
+{
+    element_t *new = malloc(sizeof(qelement_t));
+    if (!new)
+        return NULL;
+
+    new->value = s;
+    element_init_key(new, strlen(s));
+    return new;
+}
+
+/* Copy the string of e to sp, truncated to bufsize - 1 characters, for the
+ * removal functions
+ */
+static inline void element_copy(const element_t *e, char *sp, size_t bufsize)
+{
+    size_t n = element_len(e) < bufsize - 1 ? element_len(e) : bufsize - 1;
+    memcpy(sp, e->value, n);
+    sp[n] = '\0';
+}
+
+/* Byte at offset i of the string of e, which is at least i bytes long */
+static inline unsigned char element_byte(const element_t *e, size_t i)
+{
+#ifdef INLINE_KEY
+    if (i < INLINE_KEY_LEN)
+        return to_qelement(e)->key[i];
+#endif
+    return e->value[i];
+}
+
+/* Compare the strings of two elements the way strcmp() does, skipping
+ * their first skip bytes, which are known to be equal
+ */
+static inline int element_cmp_from(const element_t *a,
+                                   const element_t *b,
+                                   size_t skip)
+{
+    return compare_strings(a->value + skip, element_len(a) - skip,
+                           b->value + skip, element_len(b) - skip);
+}
+
+/* Compare the strings of two elements the way strcmp() does */
+static inline int element_cmp(const element_t *a, const element_t *b)
+{
+#ifdef INLINE_KEY
+    const char *ka = to_qelement(a)->key, *kb = to_qelement(b)->key;
+    for (int i = 0; i < INLINE_KEY_LEN; i += sizeof(uint64_t)) {
+        uint64_t wa = key_word(ka + i), wb = key_word(kb + i);
+        if (wa != wb)
+            return wa < wb ? -1 : 1;
+    }
+    /* A NUL inside the key means both strings ended there */
+    if (!ka[INLINE_KEY_LEN - 1])
+        return 0;
+    return element_cmp_from(a, b, INLINE_KEY_LEN);
+#else
+    return element_cmp_from(a, b, 0);
+#endif
+}
+
+/* Whether two elements hold the same string, telling strings of different
+ * lengths apart without reading them
+ */
+static inline bool element_equal(const element_t *a, const element_t *b)
+{
+    return element_len(a) == element_len(b) &&
+           compare_diff(a->value, b->value, element_len(a)) == element_len(a);
+}
+
+#endif /* LAB0_ELEMENT_H */
@@ -1,5 +1,6 @@
 /* Test support code */
 
+#include <pthread.h>
 #include <setjmp.h>
 #include <signal.h>
 #include <stdio.h>
@@ -27,31 +28,78 @@
 /* Byte to fill newly malloced space with */
 #define FILLCHAR 0x55
 
+/* Payloads up to this size are carved out of slabs rather than malloced */
+#define SLAB_MAX_PAYLOAD 128
+
+/* Slab size classes are spaced by this many bytes */
+#define SLAB_GRAIN 16
+
+#define SLAB_CLASSES (SLAB_MAX_PAYLOAD / SLAB_GRAIN)
+
+/* Number of blocks carved out of each slab */
+#define SLAB_SLOTS 1024
+
 /* Data structures used by our code */
 
-/* Represent allocated blocks as doubly-linked list, with
- * next and prev pointers at beginning
+/* Every allocated block starts with this header.  The addresses of all
+ * allocated blocks are kept in the registry array, and each block records
+ * its position there, so membership can be checked in constant time.
  */
 typedef struct __block_element {
-    struct __block_element *next, *prev;
+    union {
+        size_t index;                 /* Position in registry when in use */
+        struct __block_element *next; /* Next released block of its slab */
+    };
+    struct __slab *slab; /* Owning slab, NULL if obtained from malloc */
     size_t payload_size;
     size_t magic_header; /* Marker to see if block seems legitimate */
-    unsigned char payload[0];
+    unsigned char payload[0] __attribute__((aligned(16)));
     /* Also place magic number at tail of every block */
 } block_element_t;
 
-static block_element_t *allocated = NULL;
+/* A slab is one malloced chunk holding SLAB_SLOTS blocks of the same size
+ * class.  Released blocks are kept on the free list of their slab, and the
+ * whole slab goes back to malloc in one piece once its last block is freed.
+ */
+typedef struct __slab {
+    struct __slab *next, *prev; /* Slabs of this class with free blocks */
+    block_element_t *free_list; /* Released blocks, linked through next */
+    size_t live;                /* Number of blocks handed out */
+    size_t carved;              /* Number of blocks ever carved out */
+    size_t cls;                 /* Index of the size class */
+    unsigned char slots[0] __attribute__((aligned(16)));
+} slab_t;
+
+typedef struct {
+    slab_t *partial; /* Slabs with at least one free block */
+    slab_t *spare;   /* One empty slab kept around to avoid thrashing */
+} slab_class_t;
+
+static slab_class_t slab_classes[SLAB_CLASSES];
+
+/* Allocated blocks, in no particular order */
+static block_element_t **registry = NULL;
+static size_t registry_capacity = 0;
 static size_t allocated_count = 0;
+static size_t allocated_bytes = 0;
+
+/* Serializes the allocator in threaded mode */
+static pthread_mutex_t heap_lock = PTHREAD_MUTEX_INITIALIZER;
 
 /* Percent probability of malloc failure */
 int fail_probability = 0;
 
+/* Serve small allocations from slabs */
+int use_slab = 1;
+
 static bool cautious_mode = true;
 static bool noallocate_mode = false;
+static bool threaded_mode = false;
 static bool error_occurred = false;
 static char *error_message = "";
 
-static int time_limit = 1;
+/* Seconds a risky operation may run before it is aborted, 0 for no limit */
+int time_limit = 1;
 
 /* Data for managing exceptions */
 static jmp_buf env;
@@ -68,7 +116,8 @@ static bool fail_allocation()
 }
 
 /* Find header of block, given its payload.
- * Signal error if doesn't seem like legitimate block
+ * Signal error if doesn't seem like legitimate block, and return NULL if
+ * cautious mode finds that it is not allocated at all.
  */
 static block_element_t *find_header(void *p)
 {
@@ -81,17 +130,12 @@ static block_element_t *find_header(void *p)
         (block_element_t *) ((size_t) p - sizeof(block_element_t));
     if (cautious_mode) {
         /* Make sure this is really an allocated block */
-        block_element_t *ab = allocated;
-        bool found = false;
-        while (ab && !found) {
-            found = ab == b;
-            ab = ab->next;
-        }
-        if (!found) {
+        if (b->index >= allocated_count || registry[b->index] != b) {
             report_event(MSG_ERROR,
                          "Attempted to free unallocated block.  Address = %p",
                          p);
             error_occurred = true;
+            return NULL;
         }
     }
 
@@ -115,6 +159,127 @@ static size_t *find_footer(block_element_t *b)
     return p;
 }
 
+/* Bytes occupied by one block of size class cls, footer included */
+static inline size_t slab_slot_size(size_t cls)
+{
+    return sizeof(block_element_t) + (cls + 1) * SLAB_GRAIN + SLAB_GRAIN;
+}
+
+static void slab_link(slab_t *slab)
+{
+    slab_class_t *sc = &slab_classes[slab->cls];
+    slab->prev = NULL;
+    slab->next = sc->partial;
+    if (sc->partial)
+        sc->partial->prev = slab;
+    sc->partial = slab;
+}
+
+static void slab_unlink(slab_t *slab)
+{
+    slab_class_t *sc = &slab_classes[slab->cls];
+    if (slab->prev)
+        slab->prev->next = slab->next;
+    else
+        sc->partial = slab->next;
+    if (slab->next)
+        slab->next->prev = slab->prev;
+}
+
+/* Carve a block able to hold size bytes out of a slab.
+ * Return NULL when the underlying malloc fails.
+ */
+static block_element_t *slab_alloc(size_t size)
+{
+    size_t cls = size ? (size - 1) / SLAB_GRAIN : 0;
+    slab_class_t *sc = &slab_classes[cls];
+    slab_t *slab = sc->partial;
+
+    if (!slab) {
+        slab = sc->spare;
+        sc->spare = NULL;
+        if (!slab) {
+            slab = malloc(sizeof(slab_t) + SLAB_SLOTS * slab_slot_size(cls));
+            if (!slab)
+                return NULL;
+            slab->cls = cls;
+        }
+        slab->free_list = NULL;
+        slab->live = 0;
+        slab->carved = 0;
+        slab_link(slab);
+    }
+
+    block_element_t *b = slab->free_list;
+    if (b)
+        slab->free_list = b->next;
+    else
+        b = (block_element_t *) (slab->slots +
+                                 slab->carved++ * slab_slot_size(cls));
+    b->slab = slab;
+
+    /* Full slabs leave the partial list until one of their blocks returns */
+    if (++slab->live == SLAB_SLOTS)
+        slab_unlink(slab);
+    return b;
+}
+
+/* Return a block to its slab, releasing the slab once it becomes empty */
+static void slab_free(block_element_t *b)
+{
+    slab_t *slab = b->slab;
+    slab_class_t *sc = &slab_classes[slab->cls];
+
+    if (slab->live-- == SLAB_SLOTS)
+        slab_link(slab);
+    b->next = slab->free_list;
+    slab->free_list = b;
+
+    if (slab->live)
+        return;
+    slab_unlink(slab);
+    if (sc->spare)
+        free(slab);
+    else
+        sc->spare = slab;
+}
+
+/* Record a new block in the registry.  Return false if it cannot grow */
+static bool registry_add(block_element_t *b)
+{
+    if (allocated_count == registry_capacity) {
+        size_t cap = registry_capacity ? registry_capacity * 2 : 1024;
+        block_element_t **r = realloc(registry, cap * sizeof(*r));
+        if (!r)
+            return false;
+        registry = r;
+        registry_capacity = cap;
+    }
+    b->index = allocated_count;
+    registry[allocated_count++] = b;
+    return true;
+}
+
+/* Drop a block from the registry by moving the last entry into its place */
+static void registry_remove(block_element_t *b)
+{
+    block_element_t *last = registry[--allocated_count];
+    registry[b->index] = last;
+    last->index = b->index;
+}
+
+static inline void heap_enter(void)
+{
+    if (threaded_mode)
+        pthread_mutex_lock(&heap_lock);
+}
+
+static inline void heap_leave(void)
+{
+    if (threaded_mode)
+        pthread_mutex_unlock(&heap_lock);
+}
+
 /* Implementation of application functions */
 
 void *test_malloc(size_t size)
@@ -129,8 +294,25 @@ void *test_malloc(size_t size)
         return NULL;
     }
 
-    block_element_t *new_block =
-        malloc(size + sizeof(block_element_t) + sizeof(size_t));
+    block_element_t *new_block;
+    heap_enter();
+    if (use_slab && size <= SLAB_MAX_PAYLOAD) {
+        new_block = slab_alloc(size);
+    } else {
+        new_block = malloc(size + sizeof(block_element_t) + sizeof(size_t));
+        if (new_block)
+            new_block->slab = NULL;
+    }
+    if (new_block && !registry_add(new_block)) {
+        if (new_block->slab)
+            slab_free(new_block);
+        else
+            free(new_block);
+        new_block = NULL;
+    }
+    if (new_block)
+        allocated_bytes += size;
+    heap_leave();
     if (!new_block) {
         report_event(MSG_FATAL, "Couldn't allocate any more memory");
         error_occurred = true;
@@ -143,15 +325,6 @@ void *test_malloc(size_t size)
     *find_footer(new_block) = MAGICFOOTER;
     void *p = (void *) &new_block->payload;
     memset(p, FILLCHAR, size);
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->next = allocated;
-    // cppcheck-suppress nullPointerRedundantCheck
-    new_block->prev = NULL;
-
-    if (allocated)
-        allocated->prev = new_block;
-    allocated = new_block;
-    allocated_count++;
 
     return p;
 }
@@ -178,7 +351,12 @@ void test_free(void *p)
     if (!p)
         return;
 
+    heap_enter();
     block_element_t *b = find_header(p);
+    if (!b) {
+        heap_leave();
+        return;
+    }
     size_t footer = *find_footer(b);
     if (footer != MAGICFOOTER) {
         report_event(MSG_ERROR,
@@ -191,18 +369,13 @@ void test_free(void *p)
     *find_footer(b) = MAGICFREE;
     memset(p, FILLCHAR, b->payload_size);
 
-    /* Unlink from list */
-    block_element_t *bn = b->next;
-    block_element_t *bp = b->prev;
-    if (bp)
-        bp->next = bn;
+    registry_remove(b);
+    allocated_bytes -= b->payload_size;
+    if (b->slab)
+        slab_free(b);
     else
-        allocated = bn;
-    if (bn)
-        bn->prev = bp;
-
-    free(b);
-    allocated_count--;
+        free(b);
+    heap_leave();
 }
 
 // cppcheck-suppress unusedFunction
@@ -221,11 +394,17 @@ size_t allocation_check()
     return allocated_count;
 }
 
+size_t allocation_bytes()
+{
+    return allocated_bytes;
+}
+
 /* Implementation of functions for testing */
 
 /* Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
  */
+// cppcheck-suppress unusedFunction
 void set_cautious_mode(bool cautious)
 {
     cautious_mode = cautious;
@@ -239,6 +418,14 @@ void set_noallocate_mode(bool noallocate)
     noallocate_mode = noallocate;
 }
 
+/* Set/unset threaded mode.
+ * In this mode, the allocator is protected by a mutex.
+ */
+void set_threaded_mode(bool threaded)
+{
+    threaded_mode = threaded;
+}
+
 /* Return whether any errors have occurred since last time set error limit */
 bool error_check()
 {
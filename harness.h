@@ -21,9 +21,18 @@ char *test_strdup(const char *s);
 /* Report number of allocated blocks */
 size_t allocation_check();
 
+/* Report total payload size of allocated blocks, in bytes */
+size_t allocation_bytes();
+
 /* Probability of malloc failing, expressed as percent */
 extern int fail_probability;
 
+/* Whether small blocks are carved out of slabs instead of malloced */
+extern int use_slab;
+
+/* Time limit for operations guarded by exception_setup(), in seconds */
+extern int time_limit;
+
 /*
  * Set/unset cautious mode.
  * In this mode, makes extra sure any block to be freed is currently allocated.
@@ -36,6 +45,14 @@ void set_cautious_mode(bool cautious);
  */
 void set_noallocate_mode(bool noallocate);
 
+/*
+ * Set/unset threaded mode.
+ * In this mode, malloc and free may be called from several threads at once.
+ * Only turn it on while SIGALRM is blocked, since a time limit expiring
+ * inside an allocation would leave the allocator locked.
+ */
+void set_threaded_mode(bool threaded);
+
 /* Return whether any errors have occurred since last time checked */
 bool error_check();
 
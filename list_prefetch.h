@@ -0,0 +1,63 @@
+#ifndef LAB0_LIST_PREFETCH_H
+#define LAB0_LIST_PREFETCH_H
+
+/* Iteration macros for list.h that fetch the next node ahead of time.
+ *
+ * Walking a list whose nodes are scattered in memory stalls on every node.
+ * These variants start loading the next node as soon as its address is
+ * known, so that the miss overlaps with whatever the loop body does with
+ * the current one, such as reading the string of its element.  They are
+ * kept out of list.h, which must stay as distributed.
+ */
+
+#include "list.h"
+
+/**
+ * list_prefetch() - Start loading a list node into the cache
+ * @node: pointer to the node, which may be the list head
+ */
+#define list_prefetch(node) __builtin_prefetch(node)
+
+/**
+ * list_for_each_prefetch - Iterate over list nodes, prefetching the next one
+ * @node: list_head pointer used as iterator
+ * @head: pointer to the head of the list
+ *
+ * The nodes must not be removed from the list during the iteration.
+ */
+#define list_for_each_prefetch(node, head)                               \
+    for (node = (head)->next; list_prefetch(node->next), node != (head); \
+         node = node->next)
+
+/**
+ * list_for_each_safe_prefetch - Iterate over list nodes, allowing removal,
+ * prefetching the next one
+ * @node: list_head pointer used as iterator
+ * @safe: list_head pointer used to store info for next entry in list
+ * @head: pointer to the head of the list
+ *
+ * The current node may be removed from the list during the iteration.
+ */
+#define list_for_each_safe_prefetch(node, safe, head)      \
+    for (node = (head)->next, safe = node->next;           \
+         list_prefetch(safe), node != (head); node = safe, \
+        safe = node->next)
+
+/**
+ * list_for_each_entry_safe_prefetch - Iterate over list entries, allowing
+ * removal, prefetching the next one
+ * @entry: pointer used as iterator
+ * @safe: @type pointer used to store info for next entry in list
+ * @head: pointer to the head of the list
+ * @member: name of the list_head member variable in struct type of @entry
+ *
+ * The current entry may be removed from the list during the iteration.
+ */
+#define list_for_each_entry_safe_prefetch(entry, safe, head, member)       \
+    for (entry = list_entry((head)->next, __typeof__(*entry), member),     \
+        safe = list_entry(entry->member.next, __typeof__(*entry), member); \
+         list_prefetch(&safe->member), &entry->member != (head);           \
+         entry = safe,                                                     \
+        safe = list_entry(safe->member.next, __typeof__(*entry), member))
+
+#endif /* LAB0_LIST_PREFETCH_H */
@@ -4,6 +4,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "element.h"
 #include "list.h"
 #include "queue.h"
 
@@ -15,7 +16,17 @@ __attribute__((nonnull)) int cmp(const struct list_head *a,
     ela = container_of(a, element_t, list);  // cppcheck-suppress nullPointer
     elb = container_of(b, element_t, list);  // cppcheck-suppress nullPointer
 
-    return strcmp(ela->value, elb->value);
+    return element_cmp(ela, elb);
+}
+
+/* cmp() for the requested order.  Only the operands are swapped for a
+ * descending sort, so equal nodes keep their order either way.
+ */
+static inline int order_cmp(const struct list_head *a,
+                            const struct list_head *b,
+                            bool descend)
+{
+    return descend ? cmp(b, a) : cmp(a, b);
 }
 
 /*
@@ -24,13 +35,14 @@ __attribute__((nonnull)) int cmp(const struct list_head *a,
  * sentinel head node, "prev" links not maintained.
  */
 __attribute__((nonnull)) static struct list_head *merge(struct list_head *a,
-                                                        struct list_head *b)
+                                                        struct list_head *b,
+                                                        bool descend)
 {
     struct list_head *head = NULL, **tail = &head;
 
     for (;;) {
         /* if equal, take 'a' -- important for sort stability */
-        if (cmp(a, b) <= 0) {
+        if (order_cmp(a, b, descend) <= 0) {
             *tail = a;
             tail = &a->next;
             a = a->next;
@@ -51,66 +63,73 @@ __attribute__((nonnull)) static struct list_head *merge(struct list_head *a,
     return head;
 }
 
-static struct list_head *search(struct list_head *val,
-                                struct list_head *list,
-                                int stable)
+/*
+ * Return the last node of the null-terminated sorted run starting at @run
+ * that may be placed before @key, i.e. compares less than @key, or equal to
+ * it when @take_equal is set.  @run itself must qualify.  The probe distance
+ * doubles after every hit, so long runs cost only O(log n) comparisons.
+ */
+static struct list_head *search(struct list_head *run,
+                                const struct list_head *key,
+                                int take_equal,
+                                bool descend)
 {
-    struct list_head *head = list, *tail = list;
-    int k = 0, count = 2;
+    struct list_head *last = run, *probe;
+    size_t step = 1;
+
+    for (;;) {
+        probe = last;
+        for (size_t i = 0; i < step && probe->next; i++)
+            probe = probe->next;
+        if (probe == last)
+            return last; /* End of run */
 
-    while (1) {
-        for (; count > 0 && tail; count--)
-            tail = tail->next;
-        if (cmp(val, tail) <= 0 && tail)
+        int c = order_cmp(probe, key, descend);
+        if (c > 0 || (c == 0 && !take_equal))
             break;
-        k += 1;
-        count = 1 << k;
-        head = tail;
+        last = probe;
+        step <<= 1;
     }
 
-    if (stable) {
-        while (cmp(val, head) > 0)
-            head = head->next;
-    } else {
-        while (cmp(val, head) >= 0)
-            head = head->next;
+    /* The answer lies strictly between last and probe */
+    while (last->next != probe) {
+        int c = order_cmp(last->next, key, descend);
+        if (c > 0 || (c == 0 && !take_equal))
+            break;
+        last = last->next;
     }
-
-    return head;
+    return last;
 }
 
 static void gallop_merge(struct list_head *head,
                          struct list_head *a,
-                         struct list_head *b)
+                         struct list_head *b,
+                         bool descend)
 {
-    struct list_head *tail = head, *tmp = NULL;
+    struct list_head *tail = head;
 
+    /* if equal, take 'a' -- important for sort stability */
     while (a && b) {
-        if (cmp(a, b) <= 0) {
+        if (order_cmp(a, b, descend) <= 0) {
             tail->next = a;
-            tmp = search(b, a, 0);
-            tail = tmp;
-            a = tmp->next;
+            tail = search(a, b, 1, descend);
+            a = tail->next;
         } else {
             tail->next = b;
-            tmp = search(a, b, 1);
-            tail = tmp;
-            b = tmp->next;
+            tail = search(b, a, 0, descend);
+            b = tail->next;
         }
     }
+    tail->next = a ? a : b;
 
-    if (!b)
-        tmp = a;
-    else
-        tmp = b;
-
-    tail->next = tmp;
-    tmp->prev = tail;
-    while (tmp->next)
-        tmp = tmp->next;
-
-    tail->next = head;
-    head->prev = tail;
+    /* Rebuild the prev links and close the circular list */
+    struct list_head *prev = head;
+    for (struct list_head *node = head->next; node; node = node->next) {
+        node->prev = prev;
+        prev = node;
+    }
+    prev->next = head;
+    head->prev = prev;
 }
 
 
@@ -175,6 +194,7 @@ static void gallop_merge(struct list_head *head,
  * list_sort - sort a list
  * @priv: private data, opaque to list_sort(), passed to @cmp
  * @head: the list to sort
+ * @descend: sort in descending order, equal elements still keeping theirs
  * @cmp: the elements comparison function
  *
  * The comparison function @cmp must return > 0 if @a should sort after
@@ -254,7 +274,7 @@ static void gallop_merge(struct list_head *head,
  * of size 2^k varies from 2^(k-1) (cases 3 and 5 when x == 0) to
  * 2^(k+1) - 1 (second merge of case 5 when x == 2^(k-1) - 1).
  */
-__attribute__((nonnull)) void list_sort(struct list_head *head)
+__attribute__((nonnull)) void list_sort(struct list_head *head, bool descend)
 {
     struct list_head *list = head->next, *pending = NULL;
     size_t count = 0; /* Count of pending */
@@ -294,7 +314,7 @@ __attribute__((nonnull)) void list_sort(struct list_head *head)
         if (likely(bits)) {
             struct list_head *a = *tail, *b = a->prev;
 
-            a = merge(b, a);
+            a = merge(b, a, descend);
             /* Install the merged result in place of the inputs */
             a->prev = b->prev;
             *tail = a;
@@ -316,11 +336,99 @@ __attribute__((nonnull)) void list_sort(struct list_head *head)
 
         if (!next)
             break;
-        list = merge(pending, list);
+        list = merge(pending, list, descend);
         pending = next;
     }
     /* The final merge, rebuilding prev links */
     // merge_final(head, pending, list);
-    gallop_merge(head, pending, list);
+    gallop_merge(head, pending, list, descend);
 }
 // EXPORT_SYMBOL(list_sort);
+
+/* Chunks smaller than this are not worth a thread of their own */
+#define PSORT_MIN_CHUNK 1024
+
+struct psort_ctx {
+    struct list_head chunks[TPOOL_MAX_THREADS];
+    struct list_head *lists[TPOOL_MAX_THREADS]; /* Sorted, null-terminated */
+    int nlists;
+    int step; /* Distance between the lists merged in the current round */
+    bool descend;
+};
+
+static void psort_chunk(void *arg, int idx)
+{
+    struct psort_ctx *ctx = arg;
+    struct list_head *chunk = &ctx->chunks[idx];
+
+    list_sort(chunk, ctx->descend);
+    chunk->prev->next = NULL;
+    ctx->lists[idx] = chunk->next;
+}
+
+static void psort_merge(void *arg, int idx)
+{
+    struct psort_ctx *ctx = arg;
+    int i = idx * 2 * ctx->step;
+
+    ctx->lists[i] =
+        merge(ctx->lists[i], ctx->lists[i + ctx->step], ctx->descend);
+}
+
+/**
+ * list_psort - sort a list on the threads of a pool
+ * @head: the list to sort
+ * @n: number of nodes in @head
+ * @descend: sort in descending instead of ascending order
+ * @pool: threads to run on, NULL to sort on the calling thread only
+ *
+ * The list is cut into one chunk per thread and every chunk is sorted with
+ * list_sort() in parallel.  The sorted chunks are then combined by a tree of
+ * pairwise merges: each round merges neighbouring lists concurrently, so k
+ * chunks are merged in log2(k) rounds.  Neighbouring chunks are always
+ * merged with the earlier one first, which keeps the sort stable in either
+ * order.
+ */
+void list_psort(struct list_head *head, size_t n, bool descend, tpool_t *pool)
+{
+    struct psort_ctx ctx;
+    size_t k = tpool_size(pool);
+
+    if (k > n / PSORT_MIN_CHUNK)
+        k = n / PSORT_MIN_CHUNK;
+    if (k < 2) {
+        list_sort(head, descend);
+        return;
+    }
+
+    /* Cut the list into k chunks of nearly equal length */
+    struct list_head *node = head->next;
+    for (size_t i = 0; i < k; i++) {
+        struct list_head *chunk = &ctx.chunks[i], *last = node;
+        for (size_t len = n / k + (i < n % k); len > 1; len--)
+            last = last->next;
+        chunk->next = node;
+        node->prev = chunk;
+        node = last->next;
+        chunk->prev = last;
+        last->next = chunk;
+    }
+    ctx.nlists = k;
+    ctx.descend = descend;
+    tpool_run(pool, psort_chunk, &ctx, k);
+
+    for (ctx.step = 1; ctx.step < ctx.nlists; ctx.step <<= 1) {
+        int pairs = (ctx.nlists - ctx.step - 1) / (2 * ctx.step) + 1;
+        tpool_run(pool, psort_merge, &ctx, pairs);
+    }
+
+    /* Rebuild the prev links and close the circular list */
+    struct list_head *prev = head;
+    for (node = ctx.lists[0]; node; node = node->next) {
+        prev->next = node;
+        node->prev = prev;
+        prev = node;
+    }
+    prev->next = head;
+    head->prev = prev;
+}
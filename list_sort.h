@@ -3,7 +3,9 @@
 #define _LINUX_LIST_SORT_H
 
 //#include <linux/types.h>
+#include <stdbool.h>
 #include "list.h"
+#include "tpool.h"
 
 struct list_head;
 #define likely(x) __builtin_expect(!!(x), 1)
@@ -13,5 +15,10 @@ struct list_head;
 // 		const struct list_head *, const struct list_head *);
 __attribute__((nonnull)) int cmp(const struct list_head *a,
                                  const struct list_head *b);
-__attribute__((nonnull)) void list_sort(struct list_head *head);
+__attribute__((nonnull(1))) void list_sort(struct list_head *head,
+                                           bool descend);
+__attribute__((nonnull(1))) void list_psort(struct list_head *head,
+                                            size_t n,
+                                            bool descend,
+                                            tpool_t *pool);
 #endif
\ No newline at end of file
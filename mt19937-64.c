@@ -115,3 +115,23 @@ uint64_t mt19937_rand(void)
 
     return x;
 }
+
+/* Multiply-shift reduction (Lemire, "Fast Random Integer Generation in an
+ * Interval", 2019).  The low half of the product tells whether the draw
+ * landed in the short interval that would favour some outputs, in which
+ * case it is redrawn.
+ */
+uint64_t mt19937_uniform(uint64_t n)
+{
+    __uint128_t m = (__uint128_t) mt19937_rand() * n;
+    uint64_t l = (uint64_t) m;
+
+    if (l < n) {
+        uint64_t t = -n % n;
+        while (l < t) {
+            m = (__uint128_t) mt19937_rand() * n;
+            l = (uint64_t) m;
+        }
+    }
+    return m >> 64;
+}
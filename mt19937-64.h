@@ -7,3 +7,8 @@ void mt19937_init(uint64_t seed);
 
 /* generates a random number on [0, 2^64-1]-interval */
 uint64_t mt19937_rand(void);
+
+/* generates a random number on [0, n-1]-interval without modulo bias,
+ * n must be nonzero
+ */
+uint64_t mt19937_uniform(uint64_t n);
@@ -3,8 +3,12 @@
 #include <assert.h>
 #include <errno.h>
 #include <getopt.h>
+#include <pthread.h>
+#include <sched.h>
 #include <signal.h>
+#include <stdatomic.h>
 #include <spawn.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -21,10 +25,11 @@
 
 #include "dudect/fixture.h"
 #include "list.h"
+#include "mt19937-64.h"
 #include "random.h"
 
 /* Shannon entropy */
-extern double shannon_entropy(const uint8_t *input_data);
+extern double shannon_entropy(const uint8_t *input_data, size_t len);
 extern int show_entropy;
 
 /* Our program needs to use regular malloc/free */
@@ -42,9 +47,14 @@ extern int show_entropy;
  * OK as long as head field of queue_t structure is in first position in
  * solution code
  */
+#include "compare.h"
 #include "console.h"
+#include "cqueue.h"
 #include "queue.h"
 #include "report.h"
+#include "ring.h"
+#include "ulist.h"
+#include "tpool.h"
 #include "ttt.h"
 
 /* Settable parameters */
@@ -53,7 +63,6 @@ extern int show_entropy;
 
 /* How large is a queue before it's considered big.
  * This affects how it gets printed
- * and whether cautious mode is used when freeing the queue
  */
 #define BIG_LIST_SIZE 30
 
@@ -67,6 +76,79 @@ typedef struct {
 static queue_chain_t chain = {.size = 0};
 static queue_contex_t *current = NULL;
 
+/* Context of a queue created by qtest.  Queues created with "new ring N" are
+ * backed by a ring buffer instead of a list, and those created with "new
+ * unrolled" by an unrolled list.  Both leave q NULL.
+ */
+typedef struct {
+    queue_contex_t ctx;
+    ring_t *ring;
+    ulist_t *ul;
+} qtest_contex_t;
+
+static inline ring_t *ring_of(const queue_contex_t *ctx)
+{
+    return ctx ? ((const qtest_contex_t *) ctx)->ring : NULL;
+}
+
+static inline ulist_t *ulist_of(const queue_contex_t *ctx)
+{
+    return ctx ? ((const qtest_contex_t *) ctx)->ul : NULL;
+}
+
+/* Whether ctx is missing or holds no queue of any kind */
+static inline bool is_null_queue(const queue_contex_t *ctx)
+{
+    return !ctx || (!ctx->q && !ring_of(ctx) && !ulist_of(ctx));
+}
+
+/* Ring queues only support insertions, removals, size, show and free.
+ * Report an error and return true if cmd was invoked on one.
+ */
+static bool reject_ring(const char *cmd)
+{
+    if (!ring_of(current))
+        return false;
+    report(1, "ERROR: %s is not supported on ring queues", cmd);
+    return true;
+}
+
+/* Unrolled queues support what queue.h declares, plus show and rhn.  Report
+ * an error and return true if cmd was invoked on one.
+ */
+static bool reject_unrolled(const char *cmd)
+{
+    if (!ulist_of(current))
+        return false;
+    report(1, "ERROR: %s is not supported on unrolled queues", cmd);
+    return true;
+}
+
+/* Whether the strings of ul are in ascending/descending order */
+static bool ulist_ordered(const ulist_t *ul, bool descend)
+{
+    ul_iter_t it;
+    ul_iter_init(&it, ul);
+    const char *prev = ul_iter_next(&it, NULL), *cur;
+    for (; (cur = ul_iter_next(&it, NULL)); prev = cur) {
+        int r = strcmp(prev, cur);
+        if (descend ? r < 0 : r > 0)
+            return false;
+    }
+    return true;
+}
+
+/* Release a queue of any kind */
+static void queue_release(queue_contex_t *ctx)
+{
+    if (ring_of(ctx))
+        ring_free(ring_of(ctx));
+    else if (ulist_of(ctx))
+        ul_free(ulist_of(ctx));
+    else
+        q_free(ctx->q);
+}
+
 /* How many times can queue operations fail */
 static int fail_limit = BIG_LIST_SIZE;
 static int fail_count = 0;
@@ -76,9 +158,34 @@ static int string_length = MAXSTRING;
 static int descend = 0;
 static int opponent = 0;
 
+/* Number of threads used by sort, and the pool running them */
+static int threads = 1;
+static tpool_t *sort_pool = NULL;
+
+/* Number of producer threads, and of consumer threads, used by stress */
+static int concurrency = 2;
+
+/* Kernel comparing strings, one of compare_kernel_t */
+static int compare_kernel = COMPARE_AUTO;
+
+/* Whether sort compacts queues it leaves scattered in memory */
+static int auto_compact = 0;
+
+/* Whether ih/it hand harness-allocated strings over to the queue */
+static int owned = 0;
+
+/* Whether rh/rt borrow the removed string instead of copying it */
+static int view = 0;
+
 #define MIN_RANDSTR_LEN 5
 #define MAX_RANDSTR_LEN 10
 static const char charset[] = "abcdefghijklmnopqrstuvwxyz";
+
+/* Percentage of RAND strings repeating one of the last RAND_POOL_SIZE */
+static int dup_ratio = 0;
+#define RAND_POOL_SIZE 1024
+static char rand_pool[RAND_POOL_SIZE][MAX_RANDSTR_LEN];
+static int rand_pool_count = 0;
 /* For queue_insert and queue_remove */
 typedef enum {
     POS_TAIL,
@@ -86,6 +193,7 @@ typedef enum {
 } position_t;
 /* Forward declarations */
 static bool q_show(int vlevel);
+size_t q_value_len(const element_t *e);
 
 static bool do_free(int argc, char *argv[])
 {
@@ -95,16 +203,13 @@ static bool do_free(int argc, char *argv[])
     }
 
     bool ok = true;
-    if (!chain.size || !current || !current->q) {
+    if (!chain.size || is_null_queue(current)) {
         report(3,
                "Warning: There is no available queue or calling free on null "
                "queue");
     }
     error_check();
 
-    if (current && current->size > BIG_LIST_SIZE)
-        set_cautious_mode(false);
-
     struct list_head *qnext = NULL;
     if (chain.size > 1) {
         qnext = (current->chain.next == &chain.head) ? chain.head.next
@@ -115,9 +220,8 @@ static bool do_free(int argc, char *argv[])
         list_del(&current->chain);
 
         if (exception_setup(true))
-            q_free(current->q);
+            queue_release(current);
         exception_cancel();
-        set_cautious_mode(true);
     }
 
     if (current) {
@@ -141,19 +245,29 @@ static bool do_free(int argc, char *argv[])
 
 static bool do_new(int argc, char *argv[])
 {
-    if (argc != 1) {
-        report(1, "%s takes no arguments", argv[0]);
+    int capacity = 0;
+    bool unrolled = argc == 2 && !strcmp(argv[1], "unrolled");
+    if (argc == 3 && !strcmp(argv[1], "ring")) {
+        if (!get_int(argv[2], &capacity) || capacity < 1) {
+            report(1, "Invalid ring capacity '%s'", argv[2]);
+            return false;
+        }
+    } else if (argc != 1 && !unrolled) {
+        report(1, "%s takes no arguments, 'ring N' or 'unrolled'", argv[0]);
         return false;
     }
 
     bool ok = true;
 
     if (exception_setup(true)) {
-        queue_contex_t *qctx = malloc(sizeof(queue_contex_t));
+        qtest_contex_t *qtctx = malloc(sizeof(qtest_contex_t));
+        queue_contex_t *qctx = &qtctx->ctx;
         list_add_tail(&qctx->chain, &chain.head);
 
         qctx->size = 0;
-        qctx->q = q_new();
+        qtctx->ring = capacity ? ring_new(capacity) : NULL;
+        qtctx->ul = unrolled ? ul_new() : NULL;
+        qctx->q = capacity || unrolled ? NULL : q_new();
         qctx->id = chain.size++;
 
         current = qctx;
@@ -179,16 +293,182 @@ static void fill_rand_string(char *buf, size_t buf_size)
     buf[len] = '\0';
 }
 
+/* Produce the next RAND string, a repeat of a recent one with probability
+ * dup_ratio percent
+ */
+static void next_rand_string(char *buf)
+{
+    if (!dup_ratio) {
+        fill_rand_string(buf, MAX_RANDSTR_LEN);
+        return;
+    }
+
+    int filled = rand_pool_count < RAND_POOL_SIZE ? rand_pool_count
+                                                  : RAND_POOL_SIZE;
+    if (filled && rand() % 100 < dup_ratio) {
+        memcpy(buf, rand_pool[rand() % filled], MAX_RANDSTR_LEN);
+        return;
+    }
+    fill_rand_string(buf, MAX_RANDSTR_LEN);
+    memcpy(rand_pool[rand_pool_count++ % RAND_POOL_SIZE], buf,
+           MAX_RANDSTR_LEN);
+}
+
 /* insertion */
+/* Strings handed to the bulk insertion functions at once */
+#define INSERT_BATCH 1024
+
+int q_insert_head_bulk(struct list_head *head, char **strs, int n);
+int q_insert_tail_bulk(struct list_head *head, char **strs, int n);
+bool q_insert_head_owned(struct list_head *head, char *s);
+bool q_insert_tail_owned(struct list_head *head, char *s);
+
+/* Give each of strs[0], ..., strs[n - 1] a block of its own from the
+ * harness, for the queue to take over.  RAND strings are generated straight
+ * into their block.  Return the number of blocks allocated, which is less
+ * than n if the harness ran out.
+ */
+static int own_batch(char **strs, int n, bool need_rand)
+{
+    for (int i = 0; i < n; i++) {
+        char *buf;
+        if (need_rand) {
+            buf = test_malloc(MAX_RANDSTR_LEN);
+            if (buf)
+                next_rand_string(buf);
+        } else {
+            buf = test_strdup(strs[i]);
+        }
+        if (!buf)
+            return i;
+        strs[i] = buf;
+    }
+    return n;
+}
+
+/* Insert strs[0], ..., strs[n - 1] at pos of the current queue, stopping at
+ * the first failure.  With adopt set, the queue keeps the strings instead of
+ * copying them.  With bulk set, a list queue takes the whole batch with a
+ * single call.  Return the number of strings inserted.
+ */
+static int insert_batch(position_t pos,
+                        char **strs,
+                        int n,
+                        bool adopt,
+                        bool bulk)
+{
+    ring_t *ring = ring_of(current);
+    ulist_t *ul = ulist_of(current);
+    if (ul) {
+        int i = 0;
+        while (i < n && (pos == POS_TAIL ? ul_insert_tail(ul, strs[i])
+                                         : ul_insert_head(ul, strs[i])))
+            i++;
+        return i;
+    }
+    if (adopt) {
+        int i = 0;
+        while (i < n && (pos == POS_TAIL
+                             ? q_insert_tail_owned(current->q, strs[i])
+                             : q_insert_head_owned(current->q, strs[i])))
+            i++;
+        return i;
+    }
+    if (!ring && bulk)
+        return pos == POS_TAIL ? q_insert_tail_bulk(current->q, strs, n)
+                               : q_insert_head_bulk(current->q, strs, n);
+
+    int i = 0;
+    if (ring) {
+        while (i < n && (pos == POS_TAIL ? ring_insert_tail(ring, strs[i])
+                                         : ring_insert_head(ring, strs[i])))
+            i++;
+    } else {
+        while (i < n && (pos == POS_TAIL ? q_insert_tail(current->q, strs[i])
+                                         : q_insert_head(current->q, strs[i])))
+            i++;
+    }
+    return i;
+}
+
+static int ptr_cmp(const void *a, const void *b)
+{
+    uintptr_t x = (uintptr_t) *(char *const *) a;
+    uintptr_t y = (uintptr_t) *(char *const *) b;
+    return (x > y) - (x < y);
+}
+
+/* Check the done elements just inserted at pos of the current queue from
+ * strs[0], ..., strs[done - 1]: each has to hold a copy of its string, or the
+ * string itself with adopt set, and no two may share one.
+ */
+static bool check_batch(position_t pos, char **strs, int done, bool adopt)
+{
+    static char *values[INSERT_BATCH];
+    ring_t *ring = ring_of(current);
+    struct list_head *node = current->q;
+
+    /* Walk back from the newest element, which holds strs[done - 1] */
+    for (int back = 0; back < done; back++) {
+        element_t *entry;
+        if (ring) {
+            entry = ring_at(ring,
+                            pos == POS_TAIL ? current->size - 1 - back : back);
+        } else {
+            node = pos == POS_TAIL ? node->prev : node->next;
+            entry = list_entry(node, element_t, list);
+        }
+        char *cur_inserts = entry->value;
+        char *inserts = strs[done - 1 - back];
+        if (!cur_inserts) {
+            report(1, "ERROR: Failed to save copy of string in queue");
+            return false;
+        }
+        if (adopt && cur_inserts != inserts) {
+            report(1,
+                   "ERROR: Need to keep the string handed over to owned "
+                   "insertion");
+            return false;
+        }
+        if (!adopt && cur_inserts == inserts) {
+            report(1,
+                   "ERROR: Need to allocate and copy string for new queue "
+                   "element");
+            return false;
+        }
+        values[back] = cur_inserts;
+    }
+
+    qsort(values, done, sizeof(char *), ptr_cmp);
+    for (int i = 1; i < done; i++) {
+        if (values[i] == values[i - 1]) {
+            report(1,
+                   "ERROR: Need to allocate separate string for each queue "
+                   "element");
+            return false;
+        }
+    }
+    return true;
+}
+
 static bool queue_insert(position_t pos, int argc, char *argv[])
 {
+    ring_t *ring = ring_of(current);
+    ulist_t *ul = ulist_of(current);
     if (simulation) {
+        if (reject_unrolled(argv[0]))
+            return false;
         if (argc != 1) {
             report(1, "%s does not need arguments in simulation mode", argv[0]);
             return false;
         }
-        bool ok =
-            pos == POS_TAIL ? is_insert_tail_const() : is_insert_head_const();
+        bool ok;
+        if (ring)
+            ok = pos == POS_TAIL ? is_ring_insert_tail_const()
+                                 : is_ring_insert_head_const();
+        else
+            ok = pos == POS_TAIL ? is_insert_tail_const()
+                                 : is_insert_head_const();
         if (!ok) {
             report(1,
                    "ERROR: Probably not constant time or wrong implementation");
@@ -198,8 +478,8 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
         return ok;
     }
 
-    char *lasts = NULL;
-    char randstr_buf[MAX_RANDSTR_LEN];
+    static char randstrs[INSERT_BATCH][MAX_RANDSTR_LEN];
+    char *strs[INSERT_BATCH];
     int reps = 1;
     bool ok = true, need_rand = false;
     if (argc != 2 && argc != 3) {
@@ -215,57 +495,64 @@ static bool queue_insert(position_t pos, int argc, char *argv[])
         }
     }
 
-    if (!strcmp(inserts, "RAND")) {
+    if (!strcmp(inserts, "RAND"))
         need_rand = true;
-        inserts = randstr_buf;
-    }
 
-    if (!current || !current->q)
+    if (is_null_queue(current))
         report(3, "Warning: Calling insert %s on null queue",
                pos == POS_TAIL ? "tail" : "head");
     error_check();
 
+    /* Ring and unrolled queues always copy */
+    bool adopt = owned && current && current->q;
+    /* The time limit waits for the end of each batch, as one expiring
+     * halfway through would lose the elements inserted so far
+     */
+    sigset_t alrm, old;
+    sigemptyset(&alrm);
+    sigaddset(&alrm, SIGALRM);
     if (current && exception_setup(true)) {
-        for (int r = 0; ok && r < reps; r++) {
-            if (need_rand)
-                fill_rand_string(randstr_buf, sizeof(randstr_buf));
-            bool rval = pos == POS_TAIL ? q_insert_tail(current->q, inserts)
-                                        : q_insert_head(current->q, inserts);
-            if (rval) {
-                current->size++;
-                element_t *entry =
-                    pos == POS_TAIL
-                        ? list_last_entry(current->q, element_t, list)
-                        : list_first_entry(current->q, element_t, list);
-                char *cur_inserts = entry->value;
-                if (!cur_inserts) {
+        int r = 0;
+        while (ok && r < reps) {
+            int n = reps - r < INSERT_BATCH ? reps - r : INSERT_BATCH;
+            for (int i = 0; i < n; i++) {
+                if (need_rand && !adopt)
+                    next_rand_string(randstrs[i]);
+                strs[i] = need_rand && !adopt ? randstrs[i] : inserts;
+            }
+
+            pthread_sigmask(SIG_BLOCK, &alrm, &old);
+            int avail = adopt ? own_batch(strs, n, need_rand) : n;
+            int done = insert_batch(pos, strs, avail, adopt, argc == 3);
+            current->size += done;
+            r += done;
+            if (done && ul) {
+                const char *s = pos == POS_TAIL ? ul_tail(ul) : ul_head(ul);
+                if (!s || strcmp(s, strs[done - 1])) {
                     report(1, "ERROR: Failed to save copy of string in queue");
                     ok = false;
-                } else if (r == 0 && inserts == cur_inserts) {
-                    report(1,
-                           "ERROR: Need to allocate and copy string for new "
-                           "queue element");
-                    ok = false;
-                    break;
-                } else if (r == 1 && lasts == cur_inserts) {
-                    report(1,
-                           "ERROR: Need to allocate separate string for each "
-                           "queue element");
-                    ok = false;
-                    break;
                 }
-                lasts = cur_inserts;
-            } else {
+            } else if (done) {
+                ok = check_batch(pos, strs, done, adopt);
+            }
+            if (ok && done < n) {
+                /* A block own_batch() could not allocate fails the same way */
+                const char *failed = done < avail ? strs[done] : inserts;
+                r++;
                 fail_count++;
                 if (fail_count < fail_limit)
-                    report(2, "Insertion of %s failed", inserts);
+                    report(2, "Insertion of %s failed", failed);
                 else {
                     report(1,
                            "ERROR: Insertion of %s failed (%d failures total)",
-                           inserts, fail_count);
+                           failed, fail_count);
                     ok = false;
                 }
             }
+            /* Blocks the queue did not take are still ours */
+            for (int i = done; i < avail && adopt; i++)
+                test_free(strs[i]);
+            pthread_sigmask(SIG_SETMASK, &old, NULL);
             ok = ok && !error_check();
         }
     }
@@ -287,20 +574,61 @@ static bool do_it(int argc, char *argv[])
     return queue_insert(POS_TAIL, argc, argv);
 }
 
+element_t *q_remove_head_view(struct list_head *head,
+                              const char **sp,
+                              size_t *len);
+element_t *q_remove_tail_view(struct list_head *head,
+                              const char **sp,
+                              size_t *len);
+
+/* Check the view of the string of a removed element handed out by the
+ * queue, then copy its first string_length bytes to removes
+ */
+static bool take_view(const element_t *re,
+                      const char *sp,
+                      size_t len,
+                      char *removes)
+{
+    if (sp != re->value) {
+        report(1, "ERROR: Removed view does not point to string of element");
+        return false;
+    }
+    size_t expected = strlen(re->value);
+    if (len != expected) {
+        report(1, "ERROR: Removed view has length %zu != expected length %zu",
+               len, expected);
+        return false;
+    }
+
+    size_t n = len < (size_t) string_length ? len : string_length;
+    memcpy(removes, sp, n);
+    removes[n] = '\0';
+    return true;
+}
+
 static bool queue_remove(position_t pos, int argc, char *argv[])
 {
+    ring_t *ring = ring_of(current);
+    ulist_t *ul = ulist_of(current);
     /* FIXME: It is known that both functions is_remove_tail_const() and
      * is_remove_head_const() can not pass dudect on Apple M1 (based on Arm64).
      * We shall figure out the exact reasons and resolve later.
      */
 #if !(defined(__aarch64__) && defined(__APPLE__))
     if (simulation) {
+        if (reject_unrolled(argv[0]))
+            return false;
         if (argc != 1) {
             report(1, "%s does not need arguments in simulation mode", argv[0]);
             return false;
         }
-        bool ok =
-            pos == POS_TAIL ? is_remove_tail_const() : is_remove_head_const();
+        bool ok;
+        if (ring)
+            ok = pos == POS_TAIL ? is_ring_remove_tail_const()
+                                 : is_ring_remove_head_const();
+        else
+            ok = pos == POS_TAIL ? is_remove_tail_const()
+                                 : is_remove_head_const();
         if (!ok) {
             report(1,
                    "ERROR: Probably not constant time or wrong implementation");
@@ -347,19 +675,42 @@ static bool queue_remove(position_t pos, int argc, char *argv[])
                pos == POS_TAIL ? "tail" : "head");
     error_check();
 
+    /* Ring and unrolled queues always copy */
+    bool borrow = view && current && current->q;
+    const char *sp = NULL;
+    size_t len = 0;
     element_t *re = NULL;
-    if (current && exception_setup(true))
-        re = pos == POS_TAIL
-                 ? q_remove_tail(current->q, removes, string_length + 1)
-                 : q_remove_head(current->q, removes, string_length + 1);
+    bool taken = false;
+    if (current && exception_setup(true)) {
+        if (ul)
+            taken = pos == POS_TAIL
+                        ? ul_remove_tail(ul, removes, string_length + 1)
+                        : ul_remove_head(ul, removes, string_length + 1);
+        else if (borrow)
+            re = pos == POS_TAIL ? q_remove_tail_view(current->q, &sp, &len)
+                                 : q_remove_head_view(current->q, &sp, &len);
+        else
+            re = ring ? (pos == POS_TAIL ? ring_remove_tail(ring, removes,
+                                                            string_length + 1)
+                                         : ring_remove_head(ring, removes,
+                                                            string_length + 1))
+                 : pos == POS_TAIL
+                     ? q_remove_tail(current->q, removes, string_length + 1)
+                     : q_remove_head(current->q, removes, string_length + 1);
+    }
     exception_cancel();
 
-    bool is_null = re ? false : true;
+    bool is_null = re || taken ? false : true;
 
     if (!is_null) {
+        /* The view dies with the element */
+        if (borrow && !take_view(re, sp, len, removes))
+            ok = false;
+
         // q_remove_head and q_remove_tail are not responsible for releasing
         // node
-        q_release_element(re);
+        if (re)
+            q_release_element(re);
 
         removes[string_length + STRINGPAD] = '\0';
         if (removes[0] == '\0') {
@@ -416,13 +767,140 @@ static inline bool do_rt(int argc, char *argv[])
     return queue_remove(POS_TAIL, argc, argv);
 }
 
+int q_remove_head_bulk(struct list_head *head, element_t **out, int n);
+
+/* Remove n elements from head of queue, INSERT_BATCH at a time */
+static bool do_rhn(int argc, char *argv[])
+{
+    int n;
+    if (argc != 2 || !get_int(argv[1], &n) || n < 0) {
+        report(1, "%s needs a number of elements", argv[0]);
+        return false;
+    }
+
+    if (!current || current->size < n)
+        report(3, "Warning: Removing %d elements from a queue of %d", n,
+               current ? current->size : 0);
+    error_check();
+
+    element_t *out[INSERT_BATCH];
+    ring_t *ring = ring_of(current);
+    ulist_t *ul = ulist_of(current);
+    bool ok = true;
+    int removed = 0;
+    if (current && exception_setup(true)) {
+        while (ok && removed < n) {
+            int want = n - removed < INSERT_BATCH ? n - removed : INSERT_BATCH;
+            int got = 0;
+            if (ul) {
+                /* Unrolled queues have no elements to hand out */
+                while (got < want && ul_remove_head(ul, NULL, 0))
+                    got++;
+            } else if (ring) {
+                while (got < want &&
+                       (out[got] = ring_remove_head(ring, NULL, 0)))
+                    got++;
+            } else {
+                got = q_remove_head_bulk(current->q, out, want);
+            }
+            for (int i = 0; i < got && !ul; i++) {
+                if (!out[i]->value) {
+                    report(1, "ERROR: Removed element has no string");
+                    ok = false;
+                }
+                q_release_element(out[i]);
+            }
+            current->size -= got;
+            removed += got;
+            if (got < want)
+                break;
+            ok = ok && !error_check();
+        }
+    }
+    exception_cancel();
+
+    if (ok && current && removed < n && current->size > 0) {
+        report(1, "ERROR: Removed %d elements, but %d were available",
+               removed, current->size + removed);
+        ok = false;
+    }
+    report(2, "Removed %d elements from queue", removed);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
+/* Run delete_dup on an unrolled queue, checking the result against a copy
+ * of its strings
+ */
+static bool dedup_unrolled(ulist_t *ul)
+{
+    ul_iter_t it;
+    const char *str;
+    size_t len, total = 0;
+    ul_iter_init(&it, ul);
+    while (ul_iter_next(&it, &len))
+        total += len + 1;
+    char *strings = malloc(total ? total : 1);
+    if (!strings) {
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for duplicate "
+               "checking");
+        return false;
+    }
+    char *p = strings;
+    ul_iter_init(&it, ul);
+    while ((str = ul_iter_next(&it, &len))) {
+        memcpy(p, str, len + 1);
+        p += len + 1;
+    }
+    const char *end = p;
+
+    bool ok = true;
+    if (exception_setup(true))
+        ok = ul_delete_dup(ul);
+    exception_cancel();
+
+    if (!ok) {
+        free(strings);
+        report(1, "ERROR: Calling delete duplicate on null queue");
+        return false;
+    }
+
+    /* Strings equal to a neighbour must be gone, the others kept in order */
+    const char *prev = NULL;
+    ul_iter_init(&it, ul);
+    for (p = strings; p < end; prev = p, p += strlen(p) + 1) {
+        const char *next = p + strlen(p) + 1;
+        if ((prev && !strcmp(prev, p)) || (next < end && !strcmp(p, next)))
+            current->size--;
+        else if (!(str = ul_iter_next(&it, NULL)) || strcmp(str, p))
+            ok = false;
+    }
+    ok = ok && !ul_iter_next(&it, NULL);
+    if (!ok)
+        report(1,
+               "ERROR: Duplicate strings are in queue or distinct strings are "
+               "not in queue");
+    free(strings);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
 static bool do_dedup(int argc, char *argv[])
 {
+    if (reject_ring(argv[0]))
+        return false;
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
     }
 
+    if (ulist_of(current))
+        return dedup_unrolled(ulist_of(current));
+
     if (!current || !current->q) {
         report(3, "Warning: Try to access null queue");
         return false;
@@ -511,20 +989,146 @@ static bool do_dedup(int argc, char *argv[])
     return ok && !error_check();
 }
 
+/* String of the queue at position pos, for checking q_delete_dup_all */
+typedef struct {
+    const char *value;
+    int pos;
+} dedup_ref_t;
+
+static int dedup_ref_cmp(const void *a, const void *b)
+{
+    const dedup_ref_t *ra = a, *rb = b;
+    int r = strcmp(ra->value, rb->value);
+    return r ? r : ra->pos - rb->pos;
+}
+
+bool q_delete_dup_all(struct list_head *head);
+
+static bool do_dedupall(int argc, char *argv[])
+{
+    if (reject_ring(argv[0]) || reject_unrolled(argv[0]))
+        return false;
+
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
+    }
+
+    if (!current || !current->q) {
+        report(3, "Warning: Try to access null queue");
+        return false;
+    }
+    error_check();
+
+    /* Copy the strings, then find the ones occurring once by sorting */
+    int n = current->size;
+    size_t total = 0;
+    element_t *item;
+    list_for_each_entry (item, current->q, list)
+        total += strlen(item->value) + 1;
+    char *strings = malloc(total ? total : 1);
+    dedup_ref_t *refs = malloc((n ? n : 1) * sizeof(dedup_ref_t));
+    bool *keep = malloc(n ? n : 1);
+    if (!strings || !refs || !keep) {
+        free(strings);
+        free(refs);
+        free(keep);
+        report(1,
+               "INTERNAL ERROR.  Could not allocate space for duplicate "
+               "checking");
+        return false;
+    }
+
+    char *p = strings;
+    int pos = 0;
+    list_for_each_entry (item, current->q, list) {
+        size_t slen = strlen(item->value) + 1;
+        memcpy(p, item->value, slen);
+        refs[pos].value = p;
+        refs[pos].pos = pos;
+        p += slen;
+        pos++;
+    }
+    qsort(refs, n, sizeof(dedup_ref_t), dedup_ref_cmp);
+    for (int i = 0; i < n; i++) {
+        keep[refs[i].pos] =
+            (i == 0 || strcmp(refs[i - 1].value, refs[i].value)) &&
+            (i == n - 1 || strcmp(refs[i].value, refs[i + 1].value));
+    }
+
+    bool ok = true, deleted = true;
+    if (exception_setup(true))
+        deleted = q_delete_dup_all(current->q);
+    exception_cancel();
+
+    if (!deleted) {
+        /* Its table could not be allocated, which counts as a failed insert
+         * does, and the queue has to be left as it was
+         */
+        fail_count++;
+        if (fail_count < fail_limit) {
+            report(2, "Deletion of duplicates failed");
+        } else {
+            report(1,
+                   "ERROR: Deletion of duplicates failed (%d failures total)",
+                   fail_count);
+            ok = false;
+        }
+        for (int i = 0; i < n; i++)
+            keep[i] = true;
+    }
+
+    if (ok) {
+        /* Survivors must be the unique strings in their original order */
+        struct list_head *l_tmp = current->q->next;
+        p = strings;
+        for (int i = 0; i < n; i++) {
+            if (!keep[i]) {
+                current->size--;
+            } else if (l_tmp != current->q &&
+                       !strcmp(list_entry(l_tmp, element_t, list)->value, p)) {
+                l_tmp = l_tmp->next;
+            } else {
+                ok = false;
+            }
+            p += strlen(p) + 1;
+        }
+        ok = ok && l_tmp == current->q;
+        if (!ok)
+            report(1,
+                   "ERROR: Duplicate strings are in queue or distinct strings "
+                   "are not in queue in their original order");
+    }
+
+    free(strings);
+    free(refs);
+    free(keep);
+
+    q_show(3);
+    return ok && !error_check();
+}
+
 static bool do_reverse(int argc, char *argv[])
 {
+    if (reject_ring(argv[0]))
+        return false;
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
     }
 
-    if (!current || !current->q)
+    if (is_null_queue(current))
         report(3, "Warning: Calling reverse on null queue");
     error_check();
 
     set_noallocate_mode(true);
-    if (current && exception_setup(true))
-        q_reverse(current->q);
+    if (current && exception_setup(true)) {
+        if (ulist_of(current))
+            ul_reverse(ulist_of(current));
+        else
+            q_reverse(current->q);
+    }
     exception_cancel();
 
     set_noallocate_mode(false);
@@ -552,13 +1156,17 @@ static bool do_size(int argc, char *argv[])
     }
 
     int cnt = 0;
-    if (!current || !current->q)
+    ring_t *ring = ring_of(current);
+    ulist_t *ul = ulist_of(current);
+    if (is_null_queue(current))
         report(3, "Warning: Calling size on null queue");
     error_check();
 
     if (current && exception_setup(true)) {
         for (int r = 0; ok && r < reps; r++) {
-            cnt = q_size(current->q);
+            cnt = ring ? (int) ring_size(ring)
+                  : ul ? (int) ul_size(ul)
+                       : q_size(current->q);
             ok = ok && !error_check();
         }
     }
@@ -580,83 +1188,174 @@ static bool do_size(int argc, char *argv[])
     return ok && !error_check();
 }
 
-bool do_sort(int argc, char *argv[])
+static bool do_mem(int argc, char *argv[])
 {
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
     }
 
-    int cnt = 0;
-    if (!current || !current->q)
-        report(3, "Warning: Calling sort on null queue");
-    else
-        cnt = q_size(current->q);
-    error_check();
+    report(1, "%zu blocks allocated, %zu bytes in total", allocation_check(),
+           allocation_bytes());
+    return true;
+}
 
-    if (cnt < 2)
-        report(3, "Warning: Calling sort on single node");
-    error_check();
+bool q_compact(struct list_head *head);
+bool q_scattered(struct list_head *head);
 
-    set_noallocate_mode(true);
-    if (current && exception_setup(true))
-        q_sort(current->q, descend);
+/* FNV-1a hash of the strings of a queue, in order */
+static uint64_t queue_digest(struct list_head *head)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    element_t *e;
+    list_for_each_entry (e, head, list) {
+        for (const char *p = e->value;; p++) {
+            h ^= (unsigned char) *p;
+            h *= 0x100000001b3ULL;
+            if (!*p)
+                break;
+        }
+    }
+    return h;
+}
+
+/* Compact the current queue, checking that its contents did not change.
+ * Quiet is set when compaction was not asked for explicitly.
+ */
+static bool compact_current(bool quiet)
+{
+    uint64_t digest = queue_digest(current->q);
+    bool ok = false;
+    /* No time limit: aborting the relink halfway would leave the queue
+     * broken and leak the scratch buffers
+     */
+    if (exception_setup(false))
+        ok = q_compact(current->q);
     exception_cancel();
-    set_noallocate_mode(false);
 
-    bool ok = true;
-    if (current && current->size) {
-        for (struct list_head *cur_l = current->q->next;
-             cur_l != current->q && --cnt; cur_l = cur_l->next) {
-            /* Ensure each element in ascending/descending order */
-            element_t *item, *next_item;
-            item = list_entry(cur_l, element_t, list);
-            next_item = list_entry(cur_l->next, element_t, list);
-            if (!descend && strcmp(item->value, next_item->value) > 0) {
-                report(1, "ERROR: Not sorted in ascending order");
-                ok = false;
-                break;
-            }
+    if (!ok) {
+        if (!quiet)
+            report(1, "ERROR: Could not compact queue");
+        return quiet;
+    }
+    if (q_size(current->q) != current->size ||
+        queue_digest(current->q) != digest) {
+        report(1, "ERROR: Compaction changed the queue");
+        return false;
+    }
+    return true;
+}
 
-            if (descend && strcmp(item->value, next_item->value) < 0) {
-                report(1, "ERROR: Not sorted in descending order");
-                ok = false;
-                break;
-            }
-        }
+static bool do_compact(int argc, char *argv[])
+{
+    if (reject_ring(argv[0]) || reject_unrolled(argv[0]))
+        return false;
+
+    if (argc != 1) {
+        report(1, "%s takes no arguments", argv[0]);
+        return false;
     }
 
+    if (!current || !current->q) {
+        report(3, "Warning: Calling compact on null queue");
+        return !error_check();
+    }
+    error_check();
+
+    bool ok = compact_current(false);
     q_show(3);
     return ok && !error_check();
 }
 
-bool q_listsort(struct list_head *head, bool descend);
-bool do_listsort(int argc, char *argv[])
+/* Where an element was before sorting, to check equal strings keep their
+ * order
+ */
+typedef struct {
+    uintptr_t addr;
+    int pos;
+} sort_pos_t;
+
+static int sort_pos_cmp(const void *a, const void *b)
+{
+    uintptr_t x = ((const sort_pos_t *) a)->addr;
+    uintptr_t y = ((const sort_pos_t *) b)->addr;
+    return (x > y) - (x < y);
+}
+
+/* Record the position of each of the n elements of head, or return NULL if
+ * there is no memory for it
+ */
+static sort_pos_t *sort_positions(struct list_head *head, int n)
+{
+    sort_pos_t *pos = malloc(sizeof(sort_pos_t) * n);
+    if (!pos)
+        return NULL;
+    int i = 0;
+    for (struct list_head *node = head->next; node != head && i < n;
+         node = node->next, i++) {
+        pos[i].addr = (uintptr_t) node;
+        pos[i].pos = i;
+    }
+    qsort(pos, i, sizeof(sort_pos_t), sort_pos_cmp);
+    return pos;
+}
+
+static int sort_position(const sort_pos_t *pos, int n, element_t *e)
 {
+    sort_pos_t key = {.addr = (uintptr_t) &e->list};
+    sort_pos_t *found =
+        bsearch(&key, pos, n, sizeof(sort_pos_t), sort_pos_cmp);
+    return found ? found->pos : -1;
+}
+
+/* Run one of the sorting functions on the current queue and verify the
+ * result is in ascending/descending order */
+static bool queue_sort(void (*sort)(struct list_head *, bool),
+                       int argc,
+                       char *argv[])
+{
+    if (reject_ring(argv[0]))
+        return false;
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
     }
 
     int cnt = 0;
-    if (!current || !current->q)
+    ulist_t *ul = ulist_of(current);
+    if (is_null_queue(current))
         report(3, "Warning: Calling sort on null queue");
     else
-        cnt = q_size(current->q);
+        cnt = ul ? (int) ul_size(ul) : q_size(current->q);
     error_check();
 
     if (cnt < 2)
         report(3, "Warning: Calling sort on single node");
     error_check();
 
+    int n = cnt;
+    sort_pos_t *positions =
+        !ul && cnt > 1 ? sort_positions(current->q, cnt) : NULL;
+
     set_noallocate_mode(true);
-    if (current && exception_setup(true))
-        q_listsort(current->q, descend);
+    if (current && exception_setup(true)) {
+        if (ul)
+            ul_sort(ul, descend);
+        else
+            sort(current->q, descend);
+    }
     exception_cancel();
     set_noallocate_mode(false);
 
     bool ok = true;
-    if (current && current->size) {
+    if (ul) {
+        if (!ulist_ordered(ul, descend)) {
+            report(1, "ERROR: Not sorted in %s order",
+                   descend ? "descending" : "ascending");
+            ok = false;
+        }
+    } else if (current && current->size) {
         for (struct list_head *cur_l = current->q->next;
              cur_l != current->q && --cnt; cur_l = cur_l->next) {
             /* Ensure each element in ascending/descending order */
@@ -674,21 +1373,64 @@ bool do_listsort(int argc, char *argv[])
                 ok = false;
                 break;
             }
+
+            if (positions && !strcmp(item->value, next_item->value) &&
+                sort_position(positions, n, item) >
+                    sort_position(positions, n, next_item)) {
+                report(1, "ERROR: Not stable, equal strings changed order");
+                ok = false;
+                break;
+            }
         }
     }
+    free(positions);
+
+    if (ok && auto_compact && current && current->q &&
+        q_scattered(current->q))
+        ok = compact_current(true);
 
     q_show(3);
     return ok && !error_check();
 }
 
+void q_psort(struct list_head *head, bool descend, tpool_t *pool);
+static void parallel_sort(struct list_head *head, bool descend)
+{
+    q_psort(head, descend, sort_pool);
+}
+
+bool do_sort(int argc, char *argv[])
+{
+    return queue_sort(sort_pool ? parallel_sort : q_sort, argc, argv);
+}
+
+void q_listsort(struct list_head *head, bool descend);
+bool do_listsort(int argc, char *argv[])
+{
+    if (reject_unrolled(argv[0]))
+        return false;
+    return queue_sort(q_listsort, argc, argv);
+}
+
+void q_radixsort(struct list_head *head, bool descend);
+static bool do_radixsort(int argc, char *argv[])
+{
+    if (reject_unrolled(argv[0]))
+        return false;
+    return queue_sort(q_radixsort, argc, argv);
+}
+
 static bool do_dm(int argc, char *argv[])
 {
+    if (reject_ring(argv[0]))
+        return false;
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
     }
 
-    if (!current || !current->q) {
+    if (is_null_queue(current)) {
         report(3, "Warning: Try to access null queue");
         return false;
     }
@@ -696,7 +1438,8 @@ static bool do_dm(int argc, char *argv[])
 
     bool ok = true;
     if (exception_setup(true))
-        ok = q_delete_mid(current->q);
+        ok = ulist_of(current) ? ul_delete_mid(ulist_of(current))
+                               : q_delete_mid(current->q);
     exception_cancel();
 
     if (!current->size)
@@ -709,20 +1452,27 @@ static bool do_dm(int argc, char *argv[])
 
 static bool do_swap(int argc, char *argv[])
 {
+    if (reject_ring(argv[0]))
+        return false;
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
     }
 
-    if (!current || !current->q) {
+    if (is_null_queue(current)) {
         report(3, "Warning: Try to access null queue");
         return false;
     }
     error_check();
 
     set_noallocate_mode(true);
-    if (exception_setup(true))
-        q_swap(current->q);
+    if (exception_setup(true)) {
+        if (ulist_of(current))
+            ul_swap(ulist_of(current));
+        else
+            q_swap(current->q);
+    }
     exception_cancel();
 
     set_noallocate_mode(false);
@@ -734,19 +1484,22 @@ static bool do_swap(int argc, char *argv[])
 
 static bool do_ascend(int argc, char *argv[])
 {
+    if (reject_ring(argv[0]))
+        return false;
+
     if (argc != 1) {
         report(1, "%s takes too much arguments", argv[0]);
         return false;
     }
 
-    if (!current || !current->q) {
+    if (is_null_queue(current)) {
         report(3, "Warning: Calling ascend on null queue");
         return false;
     }
     error_check();
 
-
-    int cnt = q_size(current->q);
+    ulist_t *ul = ulist_of(current);
+    int cnt = ul ? (int) ul_size(ul) : q_size(current->q);
     if (!cnt)
         report(3, "Warning: Calling ascend on empty queue");
     else if (cnt < 2)
@@ -754,13 +1507,18 @@ static bool do_ascend(int argc, char *argv[])
     error_check();
 
     if (exception_setup(true))
-        current->size = q_ascend(current->q);
+        current->size = ul ? (int) ul_ascend(ul) : q_ascend(current->q);
     set_noallocate_mode(false);
 
     bool ok = true;
 
     cnt = current->size;
-    if (current->size) {
+    if (ul) {
+        if (!ulist_ordered(ul, false)) {
+            report(1, "ERROR: At least one node violated the ordering rule");
+            ok = false;
+        }
+    } else if (current->size) {
         for (struct list_head *cur_l = current->q->next;
              cur_l != current->q && --cnt; cur_l = cur_l->next) {
             element_t *item, *next_item;
@@ -781,19 +1539,22 @@ static bool do_ascend(int argc, char *argv[])
 
 static bool do_descend(int argc, char *argv[])
 {
+    if (reject_ring(argv[0]))
+        return false;
+
     if (argc != 1) {
         report(1, "%s takes too much arguments", argv[0]);
         return false;
     }
 
-    if (!current || !current->q) {
+    if (is_null_queue(current)) {
         report(3, "Warning: Calling descend on null queue");
         return false;
     }
     error_check();
 
-
-    int cnt = q_size(current->q);
+    ulist_t *ul = ulist_of(current);
+    int cnt = ul ? (int) ul_size(ul) : q_size(current->q);
     if (!cnt)
         report(3, "Warning: Calling descend on empty queue");
     else if (cnt < 2)
@@ -801,13 +1562,18 @@ static bool do_descend(int argc, char *argv[])
     error_check();
 
     if (exception_setup(true))
-        current->size = q_descend(current->q);
+        current->size = ul ? (int) ul_descend(ul) : q_descend(current->q);
     set_noallocate_mode(false);
 
     bool ok = true;
 
     cnt = current->size;
-    if (current->size) {
+    if (ul) {
+        if (!ulist_ordered(ul, true)) {
+            report(1, "ERROR: At least one node violated the ordering rule");
+            ok = false;
+        }
+    } else if (current->size) {
         for (struct list_head *cur_l = current->q->next;
              cur_l != current->q && --cnt; cur_l = cur_l->next) {
             element_t *item, *next_item;
@@ -828,9 +1594,12 @@ static bool do_descend(int argc, char *argv[])
 
 static bool do_reverseK(int argc, char *argv[])
 {
+    if (reject_ring(argv[0]))
+        return false;
+
     int k = 0;
 
-    if (!current || !current->q) {
+    if (is_null_queue(current)) {
         report(3, "Warning: Calling reverseK on null queue");
         return false;
     }
@@ -847,8 +1616,12 @@ static bool do_reverseK(int argc, char *argv[])
     }
 
     set_noallocate_mode(true);
-    if (exception_setup(true))
-        q_reverseK(current->q, k);
+    if (exception_setup(true)) {
+        if (ulist_of(current))
+            ul_reverseK(ulist_of(current), k);
+        else
+            q_reverseK(current->q, k);
+    }
     exception_cancel();
 
     set_noallocate_mode(false);
@@ -856,14 +1629,53 @@ static bool do_reverseK(int argc, char *argv[])
     return !error_check();
 }
 
+/* Merge the unrolled queues of the chain into the first one.  Queues are
+ * paired up in rounds, so that each string moves about log2(chain.size)
+ * times rather than once per queue merged before it.
+ */
+static int merge_unrolled(bool descend)
+{
+    queue_contex_t *ctx, *other;
+    for (int step = 1; step < chain.size; step *= 2) {
+        int i = 0;
+        list_for_each_entry (ctx, &chain.head, chain) {
+            if (i++ % (2 * step))
+                continue;
+            other = ctx;
+            for (int j = 0; j < step && &other->chain != &chain.head; j++)
+                other = list_entry(other->chain.next, queue_contex_t, chain);
+            if (&other->chain != &chain.head)
+                ul_merge(ulist_of(ctx), ulist_of(other), descend);
+        }
+    }
+    ctx = list_first_entry(&chain.head, queue_contex_t, chain);
+    return (int) ul_size(ulist_of(ctx));
+}
+
 static bool do_merge(int argc, char *argv[])
 {
+    queue_contex_t *ctx;
+    bool unrolled = false, lists = false;
+    list_for_each_entry (ctx, &chain.head, chain) {
+        if (ring_of(ctx)) {
+            report(1, "ERROR: %s is not supported on ring queues", argv[0]);
+            return false;
+        }
+        unrolled |= ulist_of(ctx) != NULL;
+        lists |= ctx->q != NULL;
+    }
+    if (unrolled && lists) {
+        report(1, "ERROR: %s cannot mix unrolled queues with list queues",
+               argv[0]);
+        return false;
+    }
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
     }
 
-    if (!current || !current->q) {
+    if (is_null_queue(current)) {
         report(3, "Warning: Calling merge on null queue");
         return false;
     }
@@ -872,11 +1684,12 @@ static bool do_merge(int argc, char *argv[])
     int len = 0;
     set_noallocate_mode(true);
     if (current && exception_setup(true))
-        len = q_merge(&chain.head, descend);
+        len = unrolled ? merge_unrolled(descend)
+                       : q_merge(&chain.head, descend);
     exception_cancel();
     set_noallocate_mode(false);
 
-    if (q_size(&chain.head) > 1) {
+    if (chain.size > 1) {
         chain.size = 1;
         current = list_entry(chain.head.next, queue_contex_t, chain);
         current->size = len;
@@ -885,7 +1698,7 @@ static bool do_merge(int argc, char *argv[])
         while ((uintptr_t) cur != (uintptr_t) &chain.head) {
             queue_contex_t *ctx = list_entry(cur, queue_contex_t, chain);
             cur = cur->next;
-            q_free(ctx->q);
+            queue_release(ctx);
             free(ctx);
         }
 
@@ -894,7 +1707,16 @@ static bool do_merge(int argc, char *argv[])
     }
 
     bool ok = true;
-    if (current && current->size) {
+    if (unrolled) {
+        if (!ulist_ordered(ulist_of(current), descend)) {
+            report(1,
+                   "ERROR: Not sorted in %s order (It might because of "
+                   "unsorted queues are merged or there're some flaws in "
+                   "'ul_merge')",
+                   descend ? "descending" : "ascending");
+            ok = false;
+        }
+    } else if (current && current->size) {
         for (struct list_head *cur_l = current->q->next;
              cur_l != current->q && --len; cur_l = cur_l->next) {
             /* Ensure each element in ascending order */
@@ -931,6 +1753,9 @@ void q_shuffle(struct list_head *head);
 
 static bool do_shuffle(int argc, char *argv[])
 {
+    if (reject_ring(argv[0]) || reject_unrolled(argv[0]))
+        return false;
+
     if (argc != 1) {
         report(1, "%s takes no arguments", argv[0]);
         return false;
@@ -953,6 +1778,260 @@ static bool do_shuffle(int argc, char *argv[])
     return !error_check();
 }
 
+/* A queue shared by the threads of stress, with its insert and remove.
+ * Elements are built before a run and pushed as they are, so that the
+ * threads do not meet in the harness allocator, whose lock would serialize
+ * them whatever the queue.
+ */
+typedef struct {
+    const char *name;
+    void *q;
+    bool (*push)(void *q, element_t *e);
+    element_t *(*remove)(void *q, char *sp, size_t bufsize);
+} shared_queue_t;
+
+static bool cq_push_element(void *q, element_t *e)
+{
+    return cq_push(q, e);
+}
+
+static element_t *cq_remove(void *q, char *sp, size_t bufsize)
+{
+    return cq_remove_head(q, sp, bufsize);
+}
+
+/* Single producer only: wait for the consumer whenever the ring is full */
+static bool spsc_push(void *q, element_t *e)
+{
+    while (!ring_push(q, e))
+        sched_yield();
+    return true;
+}
+
+static element_t *spsc_remove(void *q, char *sp, size_t bufsize)
+{
+    return ring_remove_head(q, sp, bufsize);
+}
+
+/* Slots of the ring stress uses with a single producer and consumer */
+#define STRESS_RING_CAPACITY 1024
+
+/* The baseline: a list behind a mutex */
+typedef struct {
+    pthread_mutex_t lock;
+    struct list_head head;
+} locked_queue_t;
+
+static bool locked_push(void *q, element_t *e)
+{
+    locked_queue_t *lq = q;
+    pthread_mutex_lock(&lq->lock);
+    list_add_tail(&e->list, &lq->head);
+    pthread_mutex_unlock(&lq->lock);
+    return true;
+}
+
+static element_t *locked_remove(void *q, char *sp, size_t bufsize)
+{
+    locked_queue_t *lq = q;
+    element_t *e = NULL;
+    pthread_mutex_lock(&lq->lock);
+    if (!list_empty(&lq->head)) {
+        e = list_first_entry(&lq->head, element_t, list);
+        list_del(&e->list);
+    }
+    pthread_mutex_unlock(&lq->lock);
+    if (e && sp) {
+        strncpy(sp, e->value, bufsize - 1);
+        sp[bufsize - 1] = '\0';
+    }
+    return e;
+}
+
+/* State of one stress run.  Producer p inserts the strings "p-i" for i in
+ * [0, per_producer), which slots holds at index p * per_producer + i while
+ * they are out of the queue.
+ */
+typedef struct {
+    shared_queue_t *sq;
+    int per_producer;
+    atomic_int remaining; /* Strings not removed yet */
+    atomic_bool failed;
+    _Atomic(element_t *) *slots;
+} stress_t;
+
+static void stress_produce(stress_t *st, int p)
+{
+    _Atomic(element_t *) *slots = st->slots + (size_t) p * st->per_producer;
+    for (int i = 0; i < st->per_producer; i++) {
+        element_t *e = atomic_exchange(&slots[i], NULL);
+        if (!st->sq->push(st->sq->q, e)) {
+            atomic_store(&slots[i], e);
+            atomic_store(&st->failed, true);
+            atomic_fetch_sub(&st->remaining, 1);
+        }
+    }
+}
+
+static void stress_consume(stress_t *st)
+{
+    char buf[32];
+    /* Strings of one producer must come out in the order it inserted them */
+    int last[TPOOL_MAX_THREADS];
+    for (int p = 0; p < concurrency; p++)
+        last[p] = -1;
+
+    while (atomic_load(&st->remaining) > 0) {
+        element_t *e = st->sq->remove(st->sq->q, buf, sizeof(buf));
+        if (!e) {
+            sched_yield();
+            continue;
+        }
+        int p, i;
+        if (strcmp(buf, e->value) || sscanf(e->value, "%d-%d", &p, &i) != 2 ||
+            p < 0 || p >= concurrency || i < 0 || i >= st->per_producer) {
+            atomic_store(&st->failed, true);
+            q_release_element(e);
+        } else {
+            /* Back to its slot, which holds it already if duplicated, or
+             * holds another element with the same string
+             */
+            size_t k = (size_t) p * st->per_producer + i;
+            element_t *old = atomic_exchange(&st->slots[k], e);
+            if (old || i <= last[p])
+                atomic_store(&st->failed, true);
+            if (old && old != e)
+                q_release_element(old);
+            last[p] = i;
+        }
+        atomic_fetch_sub(&st->remaining, 1);
+    }
+}
+
+static void stress_task(void *arg, int idx)
+{
+    stress_t *st = arg;
+    if (idx < concurrency)
+        stress_produce(st, idx);
+    else
+        stress_consume(st);
+}
+
+/* Pass the n strings per producer in slots through sq and check each came
+ * out once, back into its slot
+ */
+static bool stress_run(shared_queue_t *sq,
+                       tpool_t *pool,
+                       int n,
+                       _Atomic(element_t *) *slots)
+{
+    size_t total = (size_t) concurrency * n;
+    stress_t st = {.sq = sq, .per_producer = n, .slots = slots};
+    atomic_init(&st.remaining, total);
+    atomic_init(&st.failed, false);
+
+    double t;
+    init_time(&t);
+    set_threaded_mode(true);
+    tpool_run(pool, stress_task, &st, 2 * concurrency);
+    set_threaded_mode(false);
+    t = delta_time(&t);
+
+    bool ok = !atomic_load(&st.failed);
+    for (size_t i = 0; ok && i < total; i++)
+        ok = atomic_load(&slots[i]) != NULL;
+    if (!ok) {
+        report(1, "ERROR: %s queue lost, duplicated or reordered strings",
+               sq->name);
+        return false;
+    }
+    report(1, "%s: %zu strings in %.3f seconds, %.2f million per second",
+           sq->name, total, t, total / t / 1e6);
+    return true;
+}
+
+/* Build the elements "p-i" of stress into slots, through a queue so that
+ * they come from the harness allocator like any other element
+ */
+static bool stress_fill(_Atomic(element_t *) *slots, int n)
+{
+    struct list_head *q = q_new();
+    char buf[32];
+    bool ok = q != NULL;
+    for (int p = 0; ok && p < concurrency; p++) {
+        for (int i = 0; ok && i < n; i++) {
+            snprintf(buf, sizeof(buf), "%d-%d", p, i);
+            ok = q_insert_tail(q, buf);
+        }
+    }
+    for (size_t k = 0; ok && k < (size_t) concurrency * n; k++)
+        atomic_init(&slots[k], q_remove_head(q, NULL, 0));
+    q_free(q);
+    return ok;
+}
+
+static bool do_stress(int argc, char *argv[])
+{
+    int n = 100000;
+    if (argc > 2 || (argc == 2 && (!get_int(argv[1], &n) || n < 1))) {
+        report(1, "%s takes a positive number of strings per producer",
+               argv[0]);
+        return false;
+    }
+
+    size_t total = (size_t) concurrency * n;
+    _Atomic(element_t *) *slots = calloc(total, sizeof(*slots));
+    if (!slots || !stress_fill(slots, n)) {
+        report(1, "ERROR: Could not allocate %zu strings", total);
+        free(slots);
+        return false;
+    }
+
+    tpool_t *pool = tpool_create(2 * concurrency);
+    /* Enough nodes for every string, so that no run allocates */
+    cqueue_t *cq = cq_new(total + 1);
+    locked_queue_t lq;
+    INIT_LIST_HEAD(&lq.head);
+    ring_t *ring = concurrency == 1 ? ring_new(STRESS_RING_CAPACITY) : NULL;
+    bool ok = false;
+    if (!pool || !cq || (concurrency == 1 && !ring)) {
+        report(1, "ERROR: Could not set up %d threads and their queues",
+               2 * concurrency);
+        goto out;
+    }
+    pthread_mutex_init(&lq.lock, NULL);
+
+    shared_queue_t lock_free = {"lock-free", cq, cq_push_element, cq_remove};
+    shared_queue_t locked = {"mutex", &lq, locked_push, locked_remove};
+    shared_queue_t spsc = {"ring", ring, spsc_push, spsc_remove};
+    if (exception_setup(true))
+        ok = stress_run(&lock_free, pool, n, slots) &&
+             stress_run(&locked, pool, n, slots) &&
+             (!ring || stress_run(&spsc, pool, n, slots));
+    exception_cancel();
+    /* A time limit expiring right after a run skips its own reset */
+    set_threaded_mode(false);
+    pthread_mutex_destroy(&lq.lock);
+
+out:
+    /* Strings left in a queue by a failed run go with it */
+    for (size_t k = 0; k < total; k++) {
+        element_t *e = atomic_load(&slots[k]);
+        if (e)
+            q_release_element(e);
+    }
+    free(slots);
+    while (!list_empty(&lq.head)) {
+        element_t *e = list_first_entry(&lq.head, element_t, list);
+        list_del(&e->list);
+        q_release_element(e);
+    }
+    cq_free(cq);
+    ring_free(ring);
+    tpool_destroy(pool);
+    return ok && !error_check();
+}
+
 static bool do_ttt(int argc, char *argv[])
 {
     ttt(opponent);
@@ -984,6 +2063,38 @@ static bool q_show(int vlevel)
         return true;
 
     int cnt = 0;
+    ring_t *ring = ring_of(current);
+    if (ring) {
+        report_noreturn(vlevel, "r = [");
+        for (; cnt < current->size && cnt < BIG_LIST_SIZE; cnt++)
+            report_noreturn(vlevel, cnt == 0 ? "%s" : " %s",
+                            ring_at(ring, cnt)->value);
+        report(vlevel, cnt < current->size ? " ... ]" : "]");
+        if ((int) ring_size(ring) != current->size) {
+            report(vlevel, "ERROR:  Ring holds %zu elements instead of %d",
+                   ring_size(ring), current->size);
+            return false;
+        }
+        return true;
+    }
+
+    ulist_t *ul = ulist_of(current);
+    if (ul) {
+        ul_iter_t it;
+        const char *s;
+        ul_iter_init(&it, ul);
+        report_noreturn(vlevel, "u = [");
+        for (; cnt < BIG_LIST_SIZE && (s = ul_iter_next(&it, NULL)); cnt++)
+            report_noreturn(vlevel, cnt == 0 ? "%s" : " %s", s);
+        report(vlevel, cnt < current->size ? " ... ]" : "]");
+        if ((int) ul_size(ul) != current->size) {
+            report(vlevel, "ERROR:  Queue holds %zu strings instead of %d",
+                   ul_size(ul), current->size);
+            return false;
+        }
+        return true;
+    }
+
     if (!current || !current->q) {
         report(vlevel, "l = NULL");
         return true;
@@ -1007,7 +2118,8 @@ static bool q_show(int vlevel)
                 if (show_entropy) {
                     report_noreturn(
                         vlevel, "(%3.2f%%)",
-                        shannon_entropy((const uint8_t *) e->value));
+                        shannon_entropy((const uint8_t *) e->value,
+                                        q_value_len(e)));
                 }
             }
             cnt++;
@@ -1096,9 +2208,51 @@ static bool do_next(int argc, char *argv[])
     return q_show(0);
 }
 
+/* Restart the sorting threads whenever option threads changes */
+static void set_threads(int oldval)
+{
+    tpool_destroy(sort_pool);
+    sort_pool = NULL;
+
+    if (threads < 1 || threads > TPOOL_MAX_THREADS) {
+        report(1, "ERROR: Number of threads must be between 1 and %d",
+               TPOOL_MAX_THREADS);
+        threads = oldval;
+    }
+    if (threads > 1 && !(sort_pool = tpool_create(threads))) {
+        report(1, "ERROR: Could not start %d threads", threads);
+        threads = 1;
+    }
+}
+
+static void set_concurrency(int oldval)
+{
+    if (concurrency < 1 || concurrency > TPOOL_MAX_THREADS / 2) {
+        report(1, "ERROR: Number of producers must be between 1 and %d",
+               TPOOL_MAX_THREADS / 2);
+        concurrency = oldval;
+    }
+}
+
+static void set_compare(int oldval)
+{
+    if (compare_kernel < 0 || compare_kernel >= COMPARE_NR_KERNELS) {
+        report(1, "ERROR: Comparison kernel must be between 0 and %d",
+               COMPARE_NR_KERNELS - 1);
+        compare_kernel = oldval;
+    } else if (!compare_select(compare_kernel)) {
+        report(1, "ERROR: %s comparison is not supported on this CPU",
+               compare_name(compare_kernel));
+        compare_kernel = oldval;
+    }
+}
+
 static void console_init()
 {
-    ADD_COMMAND(new, "Create new queue", "");
+    ADD_COMMAND(new,
+                "Create new queue, backed by a ring buffer of N elements "
+                "with 'ring N' or by an unrolled list with 'unrolled'",
+                "[ring N | unrolled]");
     ADD_COMMAND(free, "Delete queue", "");
     ADD_COMMAND(prev, "Switch to previous queue", "");
     ADD_COMMAND(next, "Switch to next queue", "");
@@ -1118,14 +2272,23 @@ static void console_init()
         rt,
         "Remove from tail of queue. Optionally compare to expected value str",
         "[str]");
+    ADD_COMMAND(rhn, "Remove n elements from head of queue in batches", "n");
     ADD_COMMAND(reverse, "Reverse queue", "");
     ADD_COMMAND(sort, "Sort queue in ascending/descening order", "");
     ADD_COMMAND(listsort, "Use listsort queue in ascending/descening order",
                 "");
+    ADD_COMMAND(radixsort,
+                "Radix sort queue by string bytes in ascending/descending "
+                "order",
+                "");
     ADD_COMMAND(size, "Compute queue size n times (default: n == 1)", "[n]");
     ADD_COMMAND(show, "Show queue contents", "");
+    ADD_COMMAND(mem, "Show number and total size of allocated blocks", "");
     ADD_COMMAND(dm, "Delete middle node in queue", "");
     ADD_COMMAND(dedup, "Delete all nodes that have duplicate string", "");
+    ADD_COMMAND(dedupall,
+                "Delete all nodes that have duplicate string, in any order",
+                "");
     ADD_COMMAND(merge, "Merge all the queues into one sorted queue", "");
     ADD_COMMAND(swap, "Swap every two adjacent nodes in queue", "");
     ADD_COMMAND(ascend,
@@ -1139,17 +2302,53 @@ static void console_init()
     ADD_COMMAND(reverseK, "Reverse the nodes of the queue 'K' at a time",
                 "[K]");
     ADD_COMMAND(shuffle, "Do Fisher-Yates shuffle", "");
+    ADD_COMMAND(compact,
+                "Move elements and strings of queue in memory to follow "
+                "list order",
+                "");
+    ADD_COMMAND(stress,
+                "Pass n strings from each of 'concurrency' producers to as "
+                "many consumers through a lock-free queue, then through a "
+                "mutex-protected queue, and through a ring buffer if there "
+                "is a single producer (default: n == 100000)",
+                "[n]");
     ADD_COMMAND(ttt, "Play Tic-tac-toe game", "");
     add_param("length", &string_length, "Maximum length of displayed string",
               NULL);
     add_param("malloc", &fail_probability, "Malloc failure probability percent",
               NULL);
+    add_param("slab", &use_slab, "Carve small allocations out of slabs", NULL);
+    add_param("timeout", &time_limit,
+              "Time limit of each queue operation in seconds (0: unlimited)",
+              NULL);
     add_param("fail", &fail_limit,
               "Number of times allow queue operations to return false", NULL);
+    add_param("dup", &dup_ratio,
+              "Percentage of RAND strings repeating a recent one", NULL);
     add_param("descend", &descend,
               "Sort and merge queue in ascending/descending order", NULL);
     add_param("opponent", &opponent,
               "Choose ttt opponent: human(0) or computer(1).", NULL);
+    add_param("threads", &threads,
+              "Number of threads sort runs list_sort on in parallel",
+              set_threads);
+    add_param("compare", &compare_kernel,
+              "String comparison kernel: auto(0), scalar(1), SSE2(2) or "
+              "AVX2(3)",
+              set_compare);
+    add_param("compact", &auto_compact,
+              "Compact queues that sort leaves scattered in memory", NULL);
+    add_param("owned", &owned,
+              "Hand strings inserted by ih/it over to list queues without "
+              "copying",
+              NULL);
+    add_param("view", &view,
+              "Let rh/rt borrow removed strings from list queues instead of "
+              "copying them",
+              NULL);
+    add_param("concurrency", &concurrency,
+              "Number of producer and of consumer threads used by stress",
+              set_concurrency);
 }
 
 /* Signal handlers */
@@ -1182,22 +2381,22 @@ static void q_init()
 static bool q_quit(int argc, char *argv[])
 {
     report(3, "Freeing queue");
-    if (current && current->size > BIG_LIST_SIZE)
-        set_cautious_mode(false);
 
     if (exception_setup(true)) {
         struct list_head *cur = chain.head.next;
         while (chain.size > 0) {
             queue_contex_t *qctx = list_entry(cur, queue_contex_t, chain);
             cur = cur->next;
-            q_free(qctx->q);
+            queue_release(qctx);
             free(qctx);
             chain.size--;
         }
     }
 
     exception_cancel();
-    set_cautious_mode(true);
+
+    tpool_destroy(sort_pool);
+    sort_pool = NULL;
 
     size_t bcnt = allocation_check();
     if (bcnt > 0) {
@@ -1322,6 +2521,7 @@ int main(int argc, char *argv[])
      * with the Unix time.
      */
     srand(os_random(getpid() ^ getppid()));
+    mt19937_init(os_random(getpid() ^ getppid()));
 
     q_init();
     init_cmd();
@@ -2,7 +2,10 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include "element.h"
+#include "list_prefetch.h"
 #include "list_sort.h"
+#include "mt19937-64.h"
 
 
 /* Notice: sometimes, Cppcheck would find the potential NULL pointer bugs,
@@ -12,14 +15,33 @@
  */
 
 
+/**
+ * queue_t - Header of a queue created by q_new()
+ * @head: list head handed out to callers, kept as the first member
+ * @size: number of elements, maintained by every operation in this file
+ *
+ * Functions that may be called on bare list heads, such as q_reverse() and
+ * q_sort() on the temporary lists used internally, never touch @size.
+ */
+typedef struct {
+    struct list_head head;
+    int size;
+} queue_t;
+
+static inline queue_t *to_queue(struct list_head *head)
+{
+    return container_of(head, queue_t, head);
+}
+
 /* Create an empty queue */
 struct list_head *q_new()
 {
-    struct list_head *new = malloc(sizeof(struct list_head));
+    queue_t *new = malloc(sizeof(queue_t));
     if (!new)
         return NULL;  // to check if allocation was successful
-    INIT_LIST_HEAD(new);
-    return new;
+    INIT_LIST_HEAD(&new->head);
+    new->size = 0;
+    return &new->head;
 }
 
 /* Free all storage used by queue */
@@ -29,11 +51,11 @@ void q_free(struct list_head *head)
         return;
 
     element_t *cur, *next;
-    list_for_each_entry_safe (cur, next, head, list) {
+    list_for_each_entry_safe_prefetch (cur, next, head, list) {
         list_del(&cur->list);
         q_release_element(cur);
     }
-    free(head);
+    free(to_queue(head));
 }
 
 /* Insert an element at head of queue */
@@ -42,17 +64,12 @@ bool q_insert_head(struct list_head *head, char *s)
     if (!head)
         return false;
 
-    element_t *new = malloc(sizeof(element_t));
-    char *tmp = strdup(s);
-    if (!new || !tmp) {
-        free(new);
-        free(tmp);
-        return false;  // to check if allocation was successful
-    }
+    element_t *new = element_new(s);
+    if (!new)
+        return false;
 
-    new->value = tmp;
     list_add(&new->list, head);
-    // free(tmp);
+    to_queue(head)->size++;
     return true;
 }
 
@@ -62,20 +79,98 @@ bool q_insert_tail(struct list_head *head, char *s)
     if (!head)
         return false;
 
-    element_t *new = malloc(sizeof(element_t));
-    char *tmp = strdup(s);
-    if (!new || !tmp) {
-        free(new);
-        free(tmp);
-        return false;  // to check if allocation was successful
-    }
+    element_t *new = element_new(s);
+    if (!new)
+        return false;
+
+    list_add_tail(&new->list, head);
+    to_queue(head)->size++;
+    return true;
+}
+
+/* Insert s itself at head of queue, without copying it.  s must have been
+ * allocated with malloc() or strdup(); the queue owns it from then on and
+ * q_release_element() frees it along with its element.  Return false,
+ * leaving s to the caller, if head is NULL or could not allocate space.
+ */
+bool q_insert_head_owned(struct list_head *head, char *s)
+{
+    if (!head)
+        return false;
+
+    element_t *new = element_adopt(s);
+    if (!new)
+        return false;
+
+    list_add(&new->list, head);
+    to_queue(head)->size++;
+    return true;
+}
+
+/* Insert s itself at tail of queue, without copying it, on the same terms
+ * as q_insert_head_owned()
+ */
+bool q_insert_tail_owned(struct list_head *head, char *s)
+{
+    if (!head)
+        return false;
+
+    element_t *new = element_adopt(s);
+    if (!new)
+        return false;
 
-    new->value = tmp;
     list_add_tail(&new->list, head);
-    // free(tmp);
+    to_queue(head)->size++;
     return true;
 }
 
+/* Insert copies of strs[0], ..., strs[n - 1] at head of queue, in that
+ * order, as n calls to q_insert_head() would.  Stop at the first string that
+ * cannot be allocated.  Return the number of strings inserted.
+ *
+ * The new elements are chained on a local list first and spliced in at
+ * once, so the queue is only touched a single time.
+ */
+int q_insert_head_bulk(struct list_head *head, char **strs, int n)
+{
+    if (!head)
+        return 0;
+
+    LIST_HEAD(chain);
+    int i;
+    for (i = 0; i < n; i++) {
+        element_t *new = element_new(strs[i]);
+        if (!new)
+            break;
+        list_add(&new->list, &chain);
+    }
+    list_splice(&chain, head);
+    to_queue(head)->size += i;
+    return i;
+}
+
+/* Insert copies of strs[0], ..., strs[n - 1] at tail of queue, in that
+ * order.  Stop at the first string that cannot be allocated.  Return the
+ * number of strings inserted.
+ */
+int q_insert_tail_bulk(struct list_head *head, char **strs, int n)
+{
+    if (!head)
+        return 0;
+
+    LIST_HEAD(chain);
+    int i;
+    for (i = 0; i < n; i++) {
+        element_t *new = element_new(strs[i]);
+        if (!new)
+            break;
+        list_add_tail(&new->list, &chain);
+    }
+    list_splice_tail(&chain, head);
+    to_queue(head)->size += i;
+    return i;
+}
+
 /* Remove an element from head of queue */
 element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
 {
@@ -83,13 +178,33 @@ element_t *q_remove_head(struct list_head *head, char *sp, size_t bufsize)
         return NULL;
     element_t *rm_element = list_first_entry(head, element_t, list);
     list_del(head->next);
-    if (sp) {
-        strncpy(sp, rm_element->value, bufsize);
-        sp[bufsize - 1] = '\0';
-    }
+    to_queue(head)->size--;
+    if (sp)
+        element_copy(rm_element, sp, bufsize);
     return rm_element;
 }
 
+/* Remove up to n elements from head of queue and store them in out[], in
+ * queue order.  Return the number of elements removed.
+ *
+ * The removed run is cut off the queue with a single relink; the list
+ * nodes of the removed elements are left unspecified.
+ */
+int q_remove_head_bulk(struct list_head *head, element_t **out, int n)
+{
+    if (!head)
+        return 0;
+
+    struct list_head *node = head->next;
+    int i;
+    for (i = 0; i < n && node != head; i++, node = node->next)
+        out[i] = list_entry(node, element_t, list);
+    head->next = node;
+    node->prev = head;
+    to_queue(head)->size -= i;
+    return i;
+}
+
 /* Remove an element from tail of queue */
 element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
 {
@@ -97,25 +212,63 @@ element_t *q_remove_tail(struct list_head *head, char *sp, size_t bufsize)
         return NULL;
     element_t *rm_element = list_last_entry(head, element_t, list);
     list_del(head->prev);
-    if (sp) {
-        strncpy(sp, rm_element->value, bufsize);
-        sp[bufsize - 1] = '\0';
-    }
+    to_queue(head)->size--;
+    if (sp)
+        element_copy(rm_element, sp, bufsize);
+    return rm_element;
+}
+
+/* Hand the string of a removed element to the caller without copying it */
+static inline void element_view(const element_t *e, const char **sp,
+                                size_t *len)
+{
+    if (sp)
+        *sp = e->value;
+    if (len)
+        *len = element_len(e);
+}
+
+/* Length of the string of an element, recorded when it was created */
+size_t q_value_len(const element_t *e)
+{
+    return element_len(e);
+}
+
+/* Remove an element from head of queue, like q_remove_head(), but borrow its
+ * string instead of copying it.  If sp is non-NULL, set *sp to the string of
+ * the removed element, and if len is non-NULL, set *len to its length.  The
+ * string stays valid until the element is released.
+ */
+element_t *q_remove_head_view(struct list_head *head,
+                              const char **sp,
+                              size_t *len)
+{
+    element_t *rm_element = q_remove_head(head, NULL, 0);
+    if (rm_element)
+        element_view(rm_element, sp, len);
+    return rm_element;
+}
+
+/* Remove an element from tail of queue, borrowing its string like
+ * q_remove_head_view() does
+ */
+element_t *q_remove_tail_view(struct list_head *head,
+                              const char **sp,
+                              size_t *len)
+{
+    element_t *rm_element = q_remove_tail(head, NULL, 0);
+    if (rm_element)
+        element_view(rm_element, sp, len);
     return rm_element;
 }
 
 /* Return number of elements in queue */
 int q_size(struct list_head *head)
 {
-    if (!head || list_empty(head))
+    if (!head)
         return 0;
 
-    int len = 0;
-    struct list_head *li;
-
-    list_for_each (li, head)
-        len++;
-    return len;
+    return to_queue(head)->size;
 }
 
 /* Delete the middle node in queue */
@@ -123,14 +276,14 @@ bool q_delete_mid(struct list_head *head)
 {
     if (!head || list_empty(head))
         return false;
-    struct list_head *slow = head->next;
-    for (struct list_head *fast = head->next;
-         fast != head && fast != head->prev;) {
-        slow = slow->next;
-        fast = fast->next->next;
-    }
-    list_del(slow);
-    q_release_element(list_entry(slow, element_t, list));
+
+    queue_t *q = to_queue(head);
+    struct list_head *mid = head->next;
+    for (int i = q->size / 2; i > 0; i--)
+        mid = mid->next;
+    list_del(mid);
+    q->size--;
+    q_release_element(list_entry(mid, element_t, list));
     return true;
 }
 
@@ -140,24 +293,109 @@ bool q_delete_dup(struct list_head *head)  // false
     if (!head || list_empty(head))
         return false;
 
+    queue_t *q = to_queue(head);
     element_t *front, *back;
     bool is_dup = false;
     list_for_each_entry_safe (front, back, head, list) {
-        if (&back->list != head && strcmp(front->value, back->value) == 0) {
+        /* The body reads the next element, so fetch the one after it */
+        list_prefetch(back->list.next);
+        if (&back->list != head && element_equal(front, back)) {
             is_dup = true;
             list_del(&front->list);
             q_release_element(front);
+            q->size--;
         } else {
             if (is_dup) {
                 is_dup = false;
                 list_del(&front->list);
                 q_release_element(front);
+                q->size--;
             }
         }
     }
     return true;
 }
 
+/**
+ * dedup_slot_t - Entry of the open addressing table used by q_delete_dup_all
+ * @elem: first element seen with this string, NULL for an empty slot
+ * @hash: upper half of the string hash, checked before comparing strings
+ * @dup: whether the string occurred again later in the queue
+ */
+typedef struct {
+    element_t *elem;
+    uint32_t hash;
+    bool dup;
+} dedup_slot_t;
+
+/* 64-bit FNV-1a hash of the string of an element */
+static uint64_t dedup_hash(const element_t *e)
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    const char *s = e->value;
+    for (size_t n = element_len(e); n; n--, s++) {
+        h ^= (unsigned char) *s;
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+/* Delete all nodes whose string occurs more than once, in any order.
+ * Survivors keep their relative order.  Return false if the table could not
+ * be allocated, leaving the queue untouched.
+ *
+ * Each element is looked up in a linear probing table sized to stay at most
+ * half full, so the expected cost is O(n).  A later copy of a string is
+ * released as soon as it is found, and the first copy is only flagged so
+ * that a single sweep over the table can release it afterwards.
+ */
+bool q_delete_dup_all(struct list_head *head)
+{
+    if (!head)
+        return false;
+    if (list_empty(head))
+        return true;
+
+    queue_t *q = to_queue(head);
+    size_t cap = 2;
+    while (cap < 2 * (size_t) q->size)
+        cap <<= 1;
+    dedup_slot_t *table = malloc(cap * sizeof(dedup_slot_t));
+    if (!table)
+        return false;
+    memset(table, 0, cap * sizeof(dedup_slot_t));
+
+    element_t *entry, *safe;
+    list_for_each_entry_safe_prefetch (entry, safe, head, list) {
+        uint64_t h = dedup_hash(entry);
+        size_t i = h & (cap - 1);
+        for (; table[i].elem; i = (i + 1) & (cap - 1)) {
+            if (table[i].hash == (uint32_t) (h >> 32) &&
+                element_equal(table[i].elem, entry))
+                break;
+        }
+        if (table[i].elem) {
+            table[i].dup = true;
+            list_del(&entry->list);
+            q_release_element(entry);
+            q->size--;
+        } else {
+            table[i].elem = entry;
+            table[i].hash = h >> 32;
+        }
+    }
+
+    for (size_t i = 0; i < cap; i++) {
+        if (table[i].dup) {
+            list_del(&table[i].elem->list);
+            q_release_element(table[i].elem);
+            q->size--;
+        }
+    }
+    free(table);
+    return true;
+}
+
 /* Swap every two adjacent nodes */
 void q_swap(struct list_head *head)
 {
@@ -174,7 +412,7 @@ void q_reverse(struct list_head *head)
         return;
 
     struct list_head *cur, *next;
-    list_for_each_safe (cur, next, head) {
+    list_for_each_safe_prefetch (cur, next, head) {
         list_move(cur, head);
     }
 }
@@ -185,14 +423,13 @@ void q_reverseK(struct list_head *head, int k)
     if (!head || list_empty(head) || k == 1)
         return;
 
-    int len = q_size(head);
-    if (k > len)
+    if (k > q_size(head))
         return;
 
     struct list_head *cur, *safe, *tmp_head = head, rse;
     INIT_LIST_HEAD(&rse);
     int count = 0;
-    list_for_each_safe (cur, safe, head) {
+    list_for_each_safe_prefetch (cur, safe, head) {
         count++;
         if (count == k) {
             count = 0;
@@ -204,49 +441,219 @@ void q_reverseK(struct list_head *head, int k)
     }
 }
 
-void merge_list(struct list_head *left, struct list_head *right, bool descend)
+/* Upper bound on the pending runs of q_sort().  Run lengths on the stack grow
+ * at least like Fibonacci numbers, so 64 entries cover any int-sized queue.
+ */
+#define SORT_MAX_RUNS 64
+
+typedef struct {
+    struct list_head *head; /* Null-terminated, linked through next only */
+    int len;
+} sort_run_t;
+
+/* Compare in the requested order, so ties never count as out of order */
+static inline int sort_cmp(const struct list_head *a,
+                           const struct list_head *b,
+                           bool descend)
 {
-    if (!left || !right)
-        return;
-    LIST_HEAD(tmp);
-    for (; !list_empty(left) && !list_empty(right);) {
-        char *s1 = list_entry(left->next, element_t, list)->value;
-        char *s2 = list_entry(right->next, element_t, list)->value;
-        if (strcmp(s1, s2) >= 0) {
-            descend ? list_move_tail(left->next, &tmp)
-                    : list_move_tail(right->next, &tmp);
+    int c = element_cmp(list_entry(a, element_t, list),
+                        list_entry(b, element_t, list));
+    return descend ? -c : c;
+}
+
+/* Merge two null-terminated sorted lists, taking from a on ties */
+static struct list_head *sort_merge(struct list_head *a,
+                                    struct list_head *b,
+                                    bool descend)
+{
+    struct list_head *head = NULL, **tail = &head;
+
+    for (;;) {
+        if (sort_cmp(a, b, descend) <= 0) {
+            *tail = a;
+            tail = &a->next;
+            a = a->next;
+            if (!a) {
+                *tail = b;
+                break;
+            }
         } else {
-            descend ? list_move_tail(right->next, &tmp)
-                    : list_move_tail(left->next, &tmp);
+            *tail = b;
+            tail = &b->next;
+            b = b->next;
+            if (!b) {
+                *tail = a;
+                break;
+            }
+        }
+    }
+    return head;
+}
+
+/* Detach the maximal run starting at *list and advance *list past it.
+ * Strictly decreasing runs are reversed in place, which keeps the sort
+ * stable since they cannot contain equal neighbours.
+ */
+static sort_run_t sort_take_run(struct list_head **list, bool descend)
+{
+    struct list_head *node = *list, *next = node->next;
+    sort_run_t run = {.head = node, .len = 1};
+
+    if (next && sort_cmp(node, next, descend) > 0) {
+        node->next = NULL;
+        do {
+            struct list_head *after = next->next;
+            next->next = node;
+            node = next;
+            next = after;
+            run.len++;
+        } while (next && sort_cmp(node, next, descend) > 0);
+        run.head = node;
+    } else {
+        while (next && sort_cmp(node, next, descend) <= 0) {
+            node = next;
+            next = next->next;
+            run.len++;
+        }
+        node->next = NULL;
+    }
+    *list = next;
+    return run;
+}
+
+/* Merge the runs at positions i and i + 1 of the stack */
+static void sort_merge_at(sort_run_t *runs, int *n, int i, bool descend)
+{
+    runs[i].head = sort_merge(runs[i].head, runs[i + 1].head, descend);
+    runs[i].len += runs[i + 1].len;
+    if (i + 2 < *n)
+        runs[i + 1] = runs[i + 2];
+    (*n)--;
+}
+
+/* Restore the TimSort invariants on the lengths of the pending runs:
+ * len[i - 2] > len[i - 1] + len[i] and len[i - 1] > len[i].  Merging only
+ * neighbouring, recently produced runs keeps the working set in cache.
+ */
+static void sort_collapse(sort_run_t *runs, int *n, bool descend)
+{
+    while (*n > 1) {
+        int i = *n - 2;
+        if ((i > 0 && runs[i - 1].len <= runs[i].len + runs[i + 1].len) ||
+            (i > 1 && runs[i - 2].len <= runs[i - 1].len + runs[i].len)) {
+            if (runs[i - 1].len < runs[i + 1].len)
+                i--;
+        } else if (runs[i].len > runs[i + 1].len) {
+            break;
         }
+        sort_merge_at(runs, n, i, descend);
+    }
+}
+
+/* Sort a non-empty null-terminated list by splitting it into natural runs
+ * and merging them bottom-up.  Return the new first node.
+ */
+static struct list_head *sort_list(struct list_head *list, bool descend)
+{
+    sort_run_t runs[SORT_MAX_RUNS];
+    int n = 0;
+
+    while (list) {
+        runs[n++] = sort_take_run(&list, descend);
+        sort_collapse(runs, &n, descend);
     }
+    while (n > 1)
+        sort_merge_at(runs, &n, n - 2, descend);
+    return runs[0].head;
+}
 
-    list_splice(&tmp, left);
-    if (!list_empty(right))
-        list_splice_tail_init(right, left);
+/* Attach a null-terminated list to head, rebuilding the prev links */
+static void sort_relink(struct list_head *head, struct list_head *list)
+{
+    struct list_head *prev = head;
+    for (; list; list = list->next) {
+        prev->next = list;
+        list->prev = prev;
+        prev = list;
+    }
+    prev->next = head;
+    head->prev = prev;
 }
+
 /* Sort elements of queue in ascending/descending order */
 void q_sort(struct list_head *head, bool descend)
 {
     if (!head || list_empty(head) || list_is_singular(head))
         return;
 
-    // step1. split from middle
-    struct list_head *mid = head->next;
-    for (struct list_head *fast = head->next;
-         fast != head && fast != head->prev;) {
-        mid = mid->next;
-        fast = fast->next->next;
+    head->prev->next = NULL;
+    sort_relink(head, sort_list(head->next, descend));
+}
+
+/* Buckets smaller than this are finished by sort_list() */
+#define RADIX_CUTOFF 32
+
+/* Deeper buckets are finished by sort_list() to bound the stack usage */
+#define RADIX_MAX_DEPTH 32
+
+/* Append the null-terminated list of n nodes, whose strings all share their
+ * first depth bytes, to *tail in sorted order.  Nodes are distributed by
+ * the byte at offset depth; byte 0 collects the strings ending there, which
+ * are equal and therefore already in their final, stable order.
+ * Return the link field where the next node is to be appended.
+ */
+static struct list_head **radix_sort(struct list_head *list,
+                                     int n,
+                                     size_t depth,
+                                     bool descend,
+                                     struct list_head **tail)
+{
+    if (n < RADIX_CUTOFF || depth >= RADIX_MAX_DEPTH) {
+        *tail = sort_list(list, descend);
+        while (*tail)
+            tail = &(*tail)->next;
+        return tail;
     }
 
-    LIST_HEAD(new_list);
-    list_cut_position(&new_list, head, mid->prev);
+    struct list_head *heads[256], **tails[256];
+    int counts[256] = {0};
 
-    // step2. recursive
-    q_sort(head, descend);
-    q_sort(&new_list, descend);
+    for (int c = 0; c < 256; c++)
+        tails[c] = &heads[c];
+    for (; list; list = list->next) {
+        unsigned char c = element_byte(list_entry(list, element_t, list),
+                                       depth);
+        *tails[c] = list;
+        tails[c] = &list->next;
+        counts[c]++;
+    }
+
+    for (int i = 0; i < 256; i++) {
+        int c = descend ? 255 - i : i;
+        if (!counts[c])
+            continue;
+        *tails[c] = NULL;
+        if (c == 0 || counts[c] == 1) {
+            *tail = heads[c];
+            tail = tails[c];
+        } else {
+            tail = radix_sort(heads[c], counts[c], depth + 1, descend, tail);
+        }
+    }
+    return tail;
+}
+
+/* Sort elements of queue by the bytes of their strings, most significant
+ * byte first, in ascending/descending order */
+void q_radixsort(struct list_head *head, bool descend)
+{
+    if (!head || list_empty(head) || list_is_singular(head))
+        return;
 
-    merge_list(head, &new_list, descend);
+    struct list_head *list = NULL;
+    head->prev->next = NULL;
+    *radix_sort(head->next, q_size(head), 0, descend, &list) = NULL;
+    sort_relink(head, list);
 }
 
 /* Use linux/list_sort to sort elements of queue in
@@ -256,10 +663,17 @@ void q_listsort(struct list_head *head, bool descend)
     if (!head || list_empty(head) || list_is_singular(head))
         return;
 
-    list_sort(head);
+    list_sort(head, descend);
+}
+
+/* Use linux/list_sort on the threads of pool to sort elements of queue in
+ * ascending/descending order */
+void q_psort(struct list_head *head, bool descend, tpool_t *pool)
+{
+    if (!head || list_empty(head) || list_is_singular(head))
+        return;
 
-    if (descend)
-        q_reverse(head);
+    list_psort(head, q_size(head), descend, pool);
 }
 
 /* Remove every node which has a node with a strictly less value anywhere to
@@ -273,14 +687,16 @@ int q_ascend(struct list_head *head)
 
     struct list_head *max = head->prev, *node = head->prev->prev;
     for (; node != head;) {
-        char *s1 = list_entry(max, element_t, list)->value;
-        char *s2 = list_entry(node, element_t, list)->value;
-        if (strcmp(s1, s2) >= 0) {
+        list_prefetch(node->prev);
+        const element_t *e1 = list_entry(max, element_t, list);
+        const element_t *e2 = list_entry(node, element_t, list);
+        if (element_cmp(e1, e2) >= 0) {
             max = node;
             node = node->prev;
         } else {
             list_del(max->prev);
             q_release_element(list_entry(node, element_t, list));
+            to_queue(head)->size--;
             node = max->prev;
         }
     }
@@ -298,63 +714,408 @@ int q_descend(struct list_head *head)
 
     struct list_head *min = head->prev, *node = head->prev->prev;
     for (; node != head;) {
-        char *s1 = list_entry(min, element_t, list)->value;
-        char *s2 = list_entry(node, element_t, list)->value;
-        if (strcmp(s1, s2) <= 0) {
+        list_prefetch(node->prev);
+        const element_t *e1 = list_entry(min, element_t, list);
+        const element_t *e2 = list_entry(node, element_t, list);
+        if (element_cmp(e1, e2) <= 0) {
             min = node;
             node = node->prev;
         } else {
             list_del(min->prev);
             q_release_element(list_entry(node, element_t, list));
+            to_queue(head)->size--;
             node = min->prev;
         }
     }
     return q_size(head);
 }
 
+/* Most queues merged at once by one tournament in q_merge() */
+#define MERGE_MAX_WAYS 256
+
+/**
+ * merge_tree_t - Tournament tree over the queues being merged
+ * @src: heads of the source queues
+ * @cur: next node of each source, NULL once the source is exhausted
+ * @win: winner of every match; leaves live at [@leaves, 2 * @leaves)
+ * @leaves: number of leaves, a power of two no smaller than the source count
+ */
+typedef struct {
+    struct list_head *src[MERGE_MAX_WAYS];
+    struct list_head *cur[MERGE_MAX_WAYS];
+    int win[2 * MERGE_MAX_WAYS];
+    int leaves;
+    bool descend;
+} merge_tree_t;
+
+/* Winner of a match between sources i and j.  Exhausted sources lose and
+ * ties go to the earlier source, which keeps the merge stable.
+ */
+static int merge_match(const merge_tree_t *t, int i, int j)
+{
+    if (i < 0 || !t->cur[i])
+        return j;
+    if (j < 0 || !t->cur[j])
+        return i;
+
+    int c = element_cmp(list_entry(t->cur[i], element_t, list),
+                        list_entry(t->cur[j], element_t, list));
+    if (t->descend)
+        c = -c;
+    return c < 0 || (c == 0 && i < j) ? i : j;
+}
+
+/* Merge the n sorted queues in t->src into the first one in O(N log n) */
+static void merge_ways(merge_tree_t *t, int n)
+{
+    for (t->leaves = 1; t->leaves < n; t->leaves <<= 1)
+        ;
+    for (int i = 0; i < t->leaves; i++) {
+        bool live = i < n && !list_empty(t->src[i]);
+        t->cur[i] = live ? t->src[i]->next : NULL;
+        t->win[t->leaves + i] = i < n ? i : -1;
+    }
+    for (int i = t->leaves - 1; i > 0; i--)
+        t->win[i] = merge_match(t, t->win[2 * i], t->win[2 * i + 1]);
+
+    LIST_HEAD(out);
+    struct list_head *tail = &out;
+    for (int w = t->win[1]; w >= 0 && t->cur[w]; w = t->win[1]) {
+        struct list_head *node = t->cur[w];
+        t->cur[w] = node->next == t->src[w] ? NULL : node->next;
+        tail->next = node;
+        node->prev = tail;
+        tail = node;
+
+        /* Replay the matches on the path from the winner's leaf */
+        for (int i = (t->leaves + w) >> 1; i > 0; i >>= 1)
+            t->win[i] = merge_match(t, t->win[2 * i], t->win[2 * i + 1]);
+
+        /* The replay loaded the new head of this source; start on the node
+         * after it, which takes over the next time the source wins
+         */
+        if (t->cur[w])
+            list_prefetch(t->cur[w]->next);
+    }
+    tail->next = &out;
+    out.prev = tail;
+
+    for (int i = 0; i < n; i++)
+        INIT_LIST_HEAD(t->src[i]);
+    list_splice(&out, t->src[0]);
+}
+
 /* Merge all the queues into one sorted queue, which is in
  * ascending/descending order */
 int q_merge(struct list_head *head, bool descend)
 {
     if (!head || list_empty(head))
         return 0;
+    struct list_head *first = list_first_entry(head, queue_contex_t, chain)->q;
     if (list_is_singular(head))  // only one node
-        return list_entry(head, queue_contex_t, chain)->size;
+        return q_size(first);
 
-    queue_contex_t *cur, *next;
+    merge_tree_t t = {.descend = descend};
+    queue_contex_t *cur;
     int count = 0;
-    LIST_HEAD(tmp);
-    list_for_each_entry_safe (cur, next, head, chain) {
-        count += cur->size;
-        merge_list(&tmp, cur->q, descend);
+    list_for_each_entry (cur, head, chain) {
+        if (!cur->q)
+            continue;
+        count += q_size(cur->q);
+        to_queue(cur->q)->size = 0;
+    }
+
+    /* Merge consecutive batches of queues into the first queue of each
+     * batch, until a single batch starting at the first queue is left.
+     */
+    for (bool done = false; !done;) {
+        int n = 0, batches = 0;
+        list_for_each_entry (cur, head, chain) {
+            if (!cur->q || (cur->q != first && list_empty(cur->q)))
+                continue;
+            t.src[n++] = cur->q;
+            if (n == MERGE_MAX_WAYS) {
+                merge_ways(&t, n);
+                n = 0;
+                batches++;
+            }
+        }
+        if (n > 0) {
+            merge_ways(&t, n);
+            batches++;
+        }
+        done = batches <= 1;
     }
 
-    list_splice(&tmp, list_entry(head->next, queue_contex_t, chain)->q);
+    to_queue(first)->size = count;
     return count;
 }
 
-/*Using the Fisher-Yates shuffle algorithm to implement shuffling*/
+/* Lists at most this long are shuffled through an array on the stack */
+#define SHUFFLE_CUTOFF 4096
+/* log2 of the largest number of buckets a longer list is scattered into */
+#define SHUFFLE_MAX_BITS 12
+
+/* Fisher-Yates shuffle of a list of n <= SHUFFLE_CUTOFF nodes */
+static void shuffle_small(struct list_head *head, int n)
+{
+    struct list_head *nodes[SHUFFLE_CUTOFF], *node;
+    int i = 0;
+
+    list_for_each_prefetch (node, head)
+        nodes[i++] = node;
+    for (i = n - 1; i > 0; i--) {
+        int j = mt19937_uniform(i + 1);
+        node = nodes[i];
+        nodes[i] = nodes[j];
+        nodes[j] = node;
+    }
+
+    INIT_LIST_HEAD(head);
+    for (i = 0; i < n; i++)
+        list_add_tail(nodes[i], head);
+}
+
+/* Rao-Sandelius shuffle: send every node to a uniformly chosen bucket,
+ * shuffle each bucket on its own and concatenate them.  This produces every
+ * permutation with equal probability and needs no memory beyond the stack.
+ *
+ * The scatter pass walks the nodes in list order and keeps every bucket in
+ * that order, so only the final Fisher-Yates pass visits memory at random.
+ * Enough buckets are used for them to fit that pass right away, which keeps
+ * it to a single level up to SHUFFLE_CUTOFF << SHUFFLE_MAX_BITS / 2 nodes.
+ */
+static void shuffle_list(struct list_head *head, int n)
+{
+    if (n <= SHUFFLE_CUTOFF) {
+        shuffle_small(head, n);
+        return;
+    }
+
+    int shift = 1;
+    while (shift < SHUFFLE_MAX_BITS && (n >> shift) > SHUFFLE_CUTOFF / 2)
+        shift++;
+    const int ways = 1 << shift;
+
+    struct list_head bucket[1 << SHUFFLE_MAX_BITS];
+    int count[1 << SHUFFLE_MAX_BITS] = {0};
+    for (int b = 0; b < ways; b++)
+        INIT_LIST_HEAD(&bucket[b]);
+
+    struct list_head *node, *safe;
+    uint64_t bits = 0;
+    int avail = 0;
+    list_for_each_safe_prefetch (node, safe, head) {
+        if (avail < shift) {
+            bits = mt19937_rand();
+            avail = 64;
+        }
+        int b = bits & (ways - 1);
+        bits >>= shift;
+        avail -= shift;
+        list_add_tail(node, &bucket[b]);
+        count[b]++;
+    }
+
+    INIT_LIST_HEAD(head);
+    for (int b = 0; b < ways; b++) {
+        if (!count[b])
+            continue;
+        shuffle_list(&bucket[b], count[b]);
+        list_splice_tail(&bucket[b], head);
+    }
+}
+
 void q_shuffle(struct list_head *head)
 {
     if (!head || list_empty(head) || list_is_singular(head))
         return;
 
-    int count = q_size(head);
-    LIST_HEAD(tmp);
-    LIST_HEAD(new_list);
-    while (count > 0) {
-        // srand(time(NULL));
-        int random_index = rand() % count;
-        struct list_head *cur = head->next;
-        for (; random_index > 0; random_index--)
-            cur = cur->next;
-
-        list_cut_position(&new_list, head, cur->prev);
-        list_move(head->next, &tmp);
-        list_move(head->prev, head);
-        list_splice_init(&new_list, head);
-        --count;
-    }
-
-    list_splice_tail_init(&tmp, head);
-}
\ No newline at end of file
+    shuffle_list(head, q_size(head));
+}
+/* Distance in bytes beyond which two nodes adjacent in a list are taken to
+ * be unrelated in memory
+ */
+#define COMPACT_NEAR 4096
+
+/* Percentage of far links from which q_scattered() reports a queue */
+#define COMPACT_THRESHOLD 25
+
+/* Whether enough of the nodes of a queue lie far from their successor in
+ * memory that traversals would be bound by cache misses.  Runs of nodes
+ * going down in memory are as good as ones going up.
+ */
+bool q_scattered(struct list_head *head)
+{
+    if (!head || list_empty(head) || list_is_singular(head))
+        return false;
+
+    size_t far = 0, links = 0;
+    struct list_head *node;
+    list_for_each_prefetch (node, head) {
+        if (node->next == head)
+            break;
+        uintptr_t a = (uintptr_t) node, b = (uintptr_t) node->next;
+        far += (b > a ? b - a : a - b) > COMPACT_NEAR;
+        links++;
+    }
+    return far * 100 >= links * COMPACT_THRESHOLD;
+}
+
+/* Bits of an address sorted on by each pass of compact_sort() */
+#define COMPACT_RADIX_BITS 11
+
+/* Elements looked up ahead while copying them out in q_compact() */
+#define COMPACT_PREFETCH 8
+
+/**
+ * compact_ref_t - Block moved by q_compact()
+ * @addr: the block
+ * @len: length of the string the block holds, for string blocks
+ */
+typedef struct {
+    char *addr;
+    size_t len;
+} compact_ref_t;
+
+/* LSD radix sort of r[0..n-1] by address, using tmp as scratch space.
+ * Passes over digits on which all addresses agree are skipped.
+ */
+static void compact_sort(compact_ref_t *r, compact_ref_t *tmp, size_t n)
+{
+    const size_t radix = 1 << COMPACT_RADIX_BITS;
+    for (int shift = 0; shift < 64; shift += COMPACT_RADIX_BITS) {
+        size_t count[1 << COMPACT_RADIX_BITS] = {0};
+        for (size_t i = 0; i < n; i++)
+            count[((uintptr_t) r[i].addr >> shift) & (radix - 1)]++;
+        if (count[((uintptr_t) r[0].addr >> shift) & (radix - 1)] == n)
+            continue;
+
+        for (size_t d = 0, sum = 0; d < radix; d++) {
+            size_t c = count[d];
+            count[d] = sum;
+            sum += c;
+        }
+        for (size_t i = 0; i < n; i++)
+            tmp[count[((uintptr_t) r[i].addr >> shift) & (radix - 1)]++] =
+                r[i];
+        memcpy(r, tmp, n * sizeof(compact_ref_t));
+    }
+}
+
+/* Move the elements and strings of a queue around so that both follow list
+ * order in memory.  Return false if the scratch space could not be
+ * allocated, leaving the queue untouched.
+ *
+ * Every element and string stays a block of its own, since
+ * q_release_element() frees them one by one, so nothing is reallocated.
+ * Instead, the contents are copied out in list order and written back to
+ * the same blocks sorted by address, so that the block with the lowest
+ * address receives the first element, and so on.  Strings only trade
+ * places with strings of the same length, which are guaranteed to fit each
+ * other's blocks.
+ *
+ * Only the first walk over the list chases pointers.  The copies out are
+ * driven by an array and prefetched, and the copies back run in address
+ * order.
+ */
+bool q_compact(struct list_head *head)
+{
+    if (!head)
+        return false;
+    size_t n = to_queue(head)->size;
+    if (n < 2)
+        return true;
+
+    element_t **order = malloc(n * sizeof(element_t *));
+    if (!order)
+        return false;
+    size_t i = 0, total = 0, max_len = 0;
+    element_t *e;
+    list_for_each_entry (e, head, list) {
+        order[i++] = e;
+        total += element_len(e) + 1;
+        if (element_len(e) > max_len)
+            max_len = element_len(e);
+    }
+
+    qelement_t *elems = malloc(n * sizeof(qelement_t));
+    char *strs = malloc(total);
+    size_t *offset = malloc(n * sizeof(size_t));
+    size_t *group = malloc(n * sizeof(size_t));
+    size_t *count = malloc((max_len + 1) * sizeof(size_t));
+    compact_ref_t *ref = malloc(n * sizeof(compact_ref_t));
+    compact_ref_t *tmp = malloc(n * sizeof(compact_ref_t));
+    if (!elems || !strs || !offset || !group || !count || !ref || !tmp) {
+        free(order);
+        free(elems);
+        free(strs);
+        free(offset);
+        free(group);
+        free(count);
+        free(ref);
+        free(tmp);
+        return false;
+    }
+
+    /* Copy everything out in list order */
+    size_t off = 0;
+    for (i = 0; i < n; i++) {
+        if (i + COMPACT_PREFETCH < n)
+            __builtin_prefetch(order[i + COMPACT_PREFETCH]);
+        if (i + COMPACT_PREFETCH / 2 < n)
+            __builtin_prefetch(order[i + COMPACT_PREFETCH / 2]->value);
+        e = order[i];
+        elems[i] = *to_qelement(e);
+        offset[i] = off;
+        memcpy(strs + off, e->value, element_len(e) + 1);
+        off += element_len(e) + 1;
+        ref[i].addr = (char *) e;
+    }
+
+    /* Element i goes to the i-th lowest element block */
+    compact_sort(ref, tmp, n);
+    INIT_LIST_HEAD(head);
+    for (i = 0; i < n; i++) {
+        e = memcpy(ref[i].addr, &elems[i], sizeof(qelement_t));
+        list_add_tail(&e->list, head);
+        order[i] = e;
+    }
+
+    /* The string of the i-th element of each length goes to the i-th
+     * lowest string block of that length.  Counting sorts by length keep
+     * both list order and address order within each length.
+     */
+    for (i = 0; i < n; i++) {
+        ref[i].addr = order[i]->value;
+        ref[i].len = element_len(order[i]);
+    }
+    compact_sort(ref, tmp, n);
+    memset(count, 0, (max_len + 1) * sizeof(size_t));
+    for (i = 0; i < n; i++)
+        count[ref[i].len]++;
+    for (size_t len = 0, sum = 0; len <= max_len; len++) {
+        size_t c = count[len];
+        count[len] = sum;
+        sum += c;
+    }
+    for (i = 0; i < n; i++)
+        group[count[element_len(order[i])]++] = i;
+    for (i = n; i-- > 0;)
+        tmp[--count[ref[i].len]] = ref[i];
+    for (i = 0; i < n; i++) {
+        e = order[group[i]];
+        e->value = memcpy(tmp[i].addr, strs + offset[group[i]],
+                          element_len(e) + 1);
+    }
+
+    free(order);
+    free(elems);
+    free(strs);
+    free(offset);
+    free(group);
+    free(count);
+    free(ref);
+    free(tmp);
+    return true;
+}
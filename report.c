@@ -96,7 +96,6 @@ void report_event(message_t msg, char *fmt, ...)
 }
 
 #define BUF_SIZE 4096
-extern int web_connfd;
 void report(int level, char *fmt, ...)
 {
     if (!verbfile)
@@ -119,14 +118,15 @@ void report(int level, char *fmt, ...)
             va_end(ap);
         }
         va_start(ap, fmt);
-        vsnprintf(buffer, BUF_SIZE, fmt, ap);
+        int len = vsnprintf(buffer, BUF_SIZE - 1, fmt, ap);
         va_end(ap);
-    }
-    if (web_connfd) {
-        int len = strlen(buffer);
-        buffer[len] = '\n';
-        buffer[len + 1] = '\0';
-        web_send(web_connfd, buffer);
+        /* The output of a command from a web client goes back to it */
+        if (len >= 0) {
+            if (len > BUF_SIZE - 2)
+                len = BUF_SIZE - 2;
+            buffer[len++] = '\n';
+            web_output(buffer, len);
+        }
     }
 }
 
@@ -150,12 +150,11 @@ void report_noreturn(int level, char *fmt, ...)
             va_end(ap);
         }
         va_start(ap, fmt);
-        vsnprintf(buffer, BUF_SIZE, fmt, ap);
+        int len = vsnprintf(buffer, BUF_SIZE, fmt, ap);
         va_end(ap);
+        if (len >= 0)
+            web_output(buffer, len < BUF_SIZE ? len : BUF_SIZE - 1);
     }
-
-    if (web_connfd)
-        web_send(web_connfd, buffer);
 }
 
 /* Functions denoting failures */
@@ -0,0 +1,195 @@
+/* Bounded single-producer single-consumer ring buffer of elements */
+
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "element.h"
+#include "ring.h"
+
+/* Largest ring, so that the slot array size never overflows */
+#define RING_MAX_CAPACITY (SIZE_MAX / 4 / sizeof(element_t *))
+
+/* Indices grow without bound and are reduced modulo the capacity when used,
+ * so that tail - head is the number of elements even when the ring is full.
+ * Each side keeps a private copy of the other side's index and only reloads
+ * it when the copy says the ring is full or empty, which keeps the shared
+ * cache lines from bouncing on every operation.
+ */
+struct __ring {
+    /* Written by the consumer */
+    _Atomic size_t head __attribute__((aligned(64)));
+    size_t tail_cache;
+
+    /* Written by the producer */
+    _Atomic size_t tail __attribute__((aligned(64)));
+    size_t head_cache;
+
+    size_t mask __attribute__((aligned(64)));
+    element_t **slots;
+};
+
+ring_t *ring_new(size_t capacity)
+{
+    if (!capacity || capacity > RING_MAX_CAPACITY)
+        return NULL;
+
+    size_t cap = 1;
+    while (cap < capacity)
+        cap <<= 1;
+
+    ring_t *ring = malloc(sizeof(ring_t));
+    element_t **slots = malloc(cap * sizeof(element_t *));
+    if (!ring || !slots) {
+        free(ring);
+        free(slots);
+        return NULL;
+    }
+
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->tail_cache = 0;
+    ring->head_cache = 0;
+    ring->mask = cap - 1;
+    ring->slots = slots;
+    return ring;
+}
+
+void ring_free(ring_t *ring)
+{
+    if (!ring)
+        return;
+
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    for (; head != tail; head++)
+        q_release_element(ring->slots[head & ring->mask]);
+    free(ring->slots);
+    free(ring);
+}
+
+/* Whether the producer finds no free slot at tail */
+static bool ring_full(ring_t *ring, size_t tail)
+{
+    if (tail - ring->head_cache > ring->mask) {
+        ring->head_cache =
+            atomic_load_explicit(&ring->head, memory_order_acquire);
+        if (tail - ring->head_cache > ring->mask)
+            return true;
+    }
+    return false;
+}
+
+bool ring_insert_tail(ring_t *ring, char *s)
+{
+    if (!ring)
+        return false;
+
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (ring_full(ring, tail))
+        return false;
+
+    element_t *new = element_new(s);
+    if (!new)
+        return false;
+
+    ring->slots[tail & ring->mask] = new;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+bool ring_push(ring_t *ring, element_t *elem)
+{
+    if (!ring)
+        return false;
+
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (ring_full(ring, tail))
+        return false;
+
+    ring->slots[tail & ring->mask] = elem;
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+    return true;
+}
+
+element_t *ring_remove_head(ring_t *ring, char *sp, size_t bufsize)
+{
+    if (!ring)
+        return NULL;
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    if (head == ring->tail_cache) {
+        ring->tail_cache =
+            atomic_load_explicit(&ring->tail, memory_order_acquire);
+        if (head == ring->tail_cache)
+            return NULL;
+    }
+
+    element_t *rm = ring->slots[head & ring->mask];
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+
+    if (sp)
+        element_copy(rm, sp, bufsize);
+    return rm;
+}
+
+bool ring_insert_head(ring_t *ring, char *s)
+{
+    if (!ring)
+        return false;
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (tail - head > ring->mask)
+        return false;
+
+    element_t *new = element_new(s);
+    if (!new)
+        return false;
+
+    ring->slots[--head & ring->mask] = new;
+    ring->head_cache = head;
+    atomic_store_explicit(&ring->head, head, memory_order_release);
+    return true;
+}
+
+element_t *ring_remove_tail(ring_t *ring, char *sp, size_t bufsize)
+{
+    if (!ring)
+        return NULL;
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    if (head == tail)
+        return NULL;
+
+    element_t *rm = ring->slots[--tail & ring->mask];
+    ring->tail_cache = tail;
+    atomic_store_explicit(&ring->tail, tail, memory_order_release);
+
+    if (sp)
+        element_copy(rm, sp, bufsize);
+    return rm;
+}
+
+size_t ring_size(const ring_t *ring)
+{
+    if (!ring)
+        return 0;
+
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    return tail - head;
+}
+
+size_t ring_capacity(const ring_t *ring)
+{
+    return ring ? ring->mask + 1 : 0;
+}
+
+element_t *ring_at(const ring_t *ring, size_t i)
+{
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    return ring->slots[(head + i) & ring->mask];
+}
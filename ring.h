@@ -0,0 +1,66 @@
+#ifndef LAB0_RING_H
+#define LAB0_RING_H
+
+/* A bounded queue of elements kept in a ring buffer.
+ *
+ * One thread may insert at the tail while another removes from the head
+ * without any lock.  Each side owns one index and publishes it with release
+ * semantics; the other side reads it with acquire semantics.
+ *
+ * Insertion at the head and removal from the tail are provided as well, but
+ * move the index of the other side, so they must not run concurrently with
+ * any other operation.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "queue.h"
+
+typedef struct __ring ring_t;
+
+/* Create an empty ring holding up to capacity elements, rounded up to a
+ * power of two.  Return NULL if could not allocate space.
+ */
+ring_t *ring_new(size_t capacity);
+
+/* Free a ring and every element still in it */
+void ring_free(ring_t *ring);
+
+/* Insert a copy of s at the tail, like q_insert_tail().
+ * Return false if ring is NULL, full, or could not allocate space.
+ */
+bool ring_insert_tail(ring_t *ring, char *s);
+
+/* Insert elem, which the ring takes over, at the tail without allocating.
+ * Return false if ring is NULL or full, leaving elem to the caller.
+ */
+bool ring_push(ring_t *ring, element_t *elem);
+
+/* Insert a copy of s at the head, like q_insert_head().
+ * Return false if ring is NULL, full, or could not allocate space.
+ */
+bool ring_insert_head(ring_t *ring, char *s);
+
+/* Remove the element at the tail, like q_remove_tail().
+ * Return NULL if ring is NULL or empty.
+ */
+element_t *ring_remove_tail(ring_t *ring, char *sp, size_t bufsize);
+
+/* Remove the element at the head, like q_remove_head().
+ * Return NULL if ring is NULL or empty.
+ */
+element_t *ring_remove_head(ring_t *ring, char *sp, size_t bufsize);
+
+/* Number of elements in the ring, 0 if ring is NULL */
+size_t ring_size(const ring_t *ring);
+
+/* Number of elements the ring can hold */
+size_t ring_capacity(const ring_t *ring);
+
+/* Element at position i counting from the head, without removing it.
+ * Only meaningful while no other thread modifies the ring.
+ */
+element_t *ring_at(const ring_t *ring, size_t i);
+
+#endif /* LAB0_RING_H */
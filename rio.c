@@ -0,0 +1,97 @@
+/* Buffered line input shared by the console and the web server */
+
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "rio.h"
+
+bool rio_init(rio_t *rp, int fd, size_t size, size_t max)
+{
+    rp->buf = malloc(size);
+    if (!rp->buf)
+        return false;
+    rp->fd = fd;
+    rp->size = size;
+    rp->max = max > size ? max : size;
+    rp->start = rp->end = rp->scanned = 0;
+    rp->filled = false;
+    return true;
+}
+
+void rio_free(rio_t *rp)
+{
+    free(rp->buf);
+    rp->buf = NULL;
+    rp->size = rp->start = rp->end = rp->scanned = 0;
+}
+
+ssize_t rio_fill(rio_t *rp)
+{
+    /* Move the unread bytes, usually part of a line, to the front */
+    if (rp->start) {
+        memmove(rp->buf, rp->buf + rp->start, rp->end - rp->start);
+        rp->end -= rp->start;
+        rp->start = 0;
+    }
+
+    /* Grow a buffer full of unread bytes, or one that the last read filled,
+     * as more input is likely to be waiting
+     */
+    if ((rp->end == rp->size || rp->filled) && rp->size < rp->max) {
+        size_t size = rp->size * 2 < rp->max ? rp->size * 2 : rp->max;
+        char *buf = realloc(rp->buf, size);
+        if (buf) {
+            rp->buf = buf;
+            rp->size = size;
+        } else if (rp->end == rp->size) {
+            return -1;
+        }
+    }
+    if (rp->end == rp->size) {
+        errno = ENOBUFS;
+        return -1;
+    }
+
+    size_t room = rp->size - rp->end;
+    ssize_t n;
+    do {
+        n = read(rp->fd, rp->buf + rp->end, room);
+    } while (n < 0 && errno == EINTR);
+    rp->filled = n == (ssize_t) room;
+    if (n > 0)
+        rp->end += n;
+    return n;
+}
+
+char *rio_getline(rio_t *rp, size_t maxlen, size_t *lenp)
+{
+    char *line = rp->buf + rp->start;
+    size_t unread = rp->end - rp->start;
+    size_t len = maxlen && maxlen < unread ? maxlen : unread;
+
+    /* Bytes already scanned by an earlier call are not scanned again */
+    char *eol = len > rp->scanned
+                    ? memchr(line + rp->scanned, '\n', len - rp->scanned)
+                    : NULL;
+    if (eol) {
+        len = eol + 1 - line;
+    } else if (!maxlen || unread < maxlen) {
+        rp->scanned = unread;
+        return NULL;
+    }
+
+    rp->start += len;
+    rp->scanned = 0;
+    *lenp = len;
+    return line;
+}
+
+char *rio_getrest(rio_t *rp, size_t *lenp)
+{
+    char *rest = rp->buf + rp->start;
+    *lenp = rp->end - rp->start;
+    rp->start = rp->end = rp->scanned = 0;
+    return rest;
+}
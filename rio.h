@@ -0,0 +1,60 @@
+#ifndef LAB0_RIO_H
+#define LAB0_RIO_H
+
+/* Buffered input split into lines, after the RIO package of CS:APP.
+ *
+ * Input is read in bulk into a buffer, where lines are found with memchr(),
+ * which looks at a word or a vector of bytes at a time, and handed out in
+ * place without copying.  The buffer starts small and doubles, up to a
+ * limit, whenever a read fills it: a file read in bulk soon gets large reads,
+ * while a socket carrying a request at a time keeps a small buffer.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <sys/types.h>
+
+typedef struct {
+    int fd;         /* Descriptor read from */
+    char *buf;      /* Internal buffer */
+    size_t size;    /* Size of buf */
+    size_t max;     /* Size buf may grow to */
+    size_t start;   /* First unread byte in buf */
+    size_t end;     /* End of the bytes read into buf */
+    size_t scanned; /* Unread bytes known to hold no newline */
+    bool filled;    /* The last read filled the buffer */
+} rio_t;
+
+/* Prepare to read fd with a buffer of size bytes, which may grow to max.
+ * Return false if could not allocate space.
+ */
+bool rio_init(rio_t *rp, int fd, size_t size, size_t max);
+
+/* Free the buffer of rp.  The descriptor is left open. */
+void rio_free(rio_t *rp);
+
+/* Read once from the descriptor into the buffer, making room for it first.
+ * Return the result of read(), which is retried if interrupted by a signal,
+ * or -1 with errno set to ENOBUFS if max unread bytes fill the buffer.
+ */
+ssize_t rio_fill(rio_t *rp);
+
+/* Take the next line from the buffer, newline included, and store its
+ * length to *lenp.  If maxlen is not 0, a line longer than maxlen bytes is
+ * cut after maxlen bytes.  Return NULL if the buffer holds no complete line.
+ * The line stays valid until the next call to rio_fill().
+ */
+char *rio_getline(rio_t *rp, size_t maxlen, size_t *lenp);
+
+/* Take every unread byte, e.g. a last line without newline at end of file,
+ * and store their count to *lenp
+ */
+char *rio_getrest(rio_t *rp, size_t *lenp);
+
+/* Number of unread bytes */
+static inline size_t rio_unread(const rio_t *rp)
+{
+    return rp->end - rp->start;
+}
+
+#endif /* LAB0_RIO_H */
@@ -0,0 +1,111 @@
+#!/usr/bin/env python3
+
+# Benchmarks of qtest whose command files are too repetitive to keep under
+# bench/.
+#
+# Write the commands of each benchmark named on the command line, or of all
+# of them, to a temporary file and run qtest on it the way "make bench" runs
+# the files under bench/.  With "-o", write the commands to a file instead.
+
+import argparse
+import os
+import subprocess
+import sys
+import tempfile
+
+SETUP = ["option fail 0", "option malloc 0", "option timeout 0"]
+
+# 1 KB strings that differ only in their last four bytes
+LONG_SUFFIXES = ["bear", "wolf", "mole", "lynx"]
+
+
+def long_strings(count):
+    prefix = ("abcdefghijklmnopqrstuvwxyz" * 40)[:1020]
+    for suffix in LONG_SUFFIXES:
+        yield "it %s%s %d" % (prefix, suffix, count)
+
+
+def merge():
+    yield "# Merge 300 sorted queues of 2000 random strings each"
+    yield from SETUP
+    for _ in range(300):
+        yield "new"
+        yield "ih RAND 2000"
+        yield "sort"
+    yield "time merge"
+    yield "free"
+
+
+def long():
+    yield ("# Sort and deduplicate queues of 1 KB strings that differ only in "
+           "their")
+    yield "# last few bytes"
+    yield from SETUP
+    for ops in (["time sort", "time dedup"], ["time dedupall"]):
+        yield "new"
+        yield from long_strings(50000)
+        yield "shuffle"
+        yield from ops
+        yield "size"
+        yield "free"
+
+
+def compare():
+    yield ("# Sort with each string comparison kernel, on 1 KB strings "
+           "differing only")
+    yield "# at their end and on short random strings"
+    yield from SETUP
+    for kernel in range(1, 4):
+        yield "option compare %d" % kernel
+        yield "new"
+        yield from long_strings(50000)
+        yield "shuffle"
+        yield "time sort"
+        yield "free"
+        yield "new"
+        yield "it RAND 1000000"
+        yield "time sort"
+        yield "free"
+
+
+BENCHMARKS = {
+    "merge": merge,
+    "long": long,
+    "compare": compare,
+}
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Generate and run qtest benchmarks")
+    parser.add_argument("names", nargs="*", metavar="name",
+                        help="benchmarks to run: %s (default all)" %
+                        ", ".join(BENCHMARKS))
+    parser.add_argument("-o", "--output",
+                        help="write the commands to this file, do not run")
+    parser.add_argument("--qtest", default="./qtest",
+                        help="qtest binary (default ./qtest)")
+    args = parser.parse_args()
+
+    names = args.names or list(BENCHMARKS)
+    for name in names:
+        if name not in BENCHMARKS:
+            parser.error("unknown benchmark '%s'" % name)
+    lines = [line for name in names for line in BENCHMARKS[name]()]
+
+    if args.output:
+        with open(args.output, "w") as f:
+            f.write("\n".join(lines) + "\n")
+        return 0
+
+    fd, path = tempfile.mkstemp(suffix=".cmd")
+    try:
+        with os.fdopen(fd, "w") as f:
+            f.write("\n".join(lines) + "\n")
+        return subprocess.call([args.qtest, "-v", "1", "-f", path])
+    finally:
+        os.unlink(path)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
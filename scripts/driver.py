@@ -35,7 +35,19 @@ class Tracer:
         14: "trace-14-perf",
         15: "trace-15-perf",
         16: "trace-16-perf",
-        17: "trace-17-complexity"
+        17: "trace-17-complexity",
+        18: "trace-18-unrolled",
+        19: "trace-19-ring-ops",
+        20: "trace-20-ring-robust",
+        21: "trace-21-ring-malloc",
+        22: "trace-22-ring-malloc",
+        23: "trace-23-ring-malloc",
+        24: "trace-24-ring-complexity",
+        25: "trace-25-radixsort",
+        26: "trace-26-dedupall",
+        27: "trace-27-owned",
+        28: "trace-28-view",
+        29: "trace-29-compact"
     }
 
     traceProbs = {
@@ -55,10 +67,23 @@ class Tracer:
         14: "Trace-14",
         15: "Trace-15",
         16: "Trace-16",
-        17: "Trace-17"
+        17: "Trace-17",
+        18: "Trace-18",
+        19: "Trace-19",
+        20: "Trace-20",
+        21: "Trace-21",
+        22: "Trace-22",
+        23: "Trace-23",
+        24: "Trace-24",
+        25: "Trace-25",
+        26: "Trace-26",
+        27: "Trace-27",
+        28: "Trace-28",
+        29: "Trace-29"
     }
 
-    maxScores = [0, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 5]
+    maxScores = [0, 5, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 6, 5,
+                 6, 5, 6, 6, 6, 6, 5, 6, 6, 6, 6, 6]
 
     RED = '\033[91m'
     GREEN = '\033[92m'
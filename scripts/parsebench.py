@@ -0,0 +1,98 @@
+#!/usr/bin/env python3
+
+# Microbenchmark of the command input of qtest.
+#
+# Write a large command file, by default 100 MB, then time qtest reading it
+# with "-f".  The file either holds long comments, which cost little to run
+# beyond reading and splitting them into words, or a mix of queue operations
+# like the traces use.  Report the throughput in MB and lines per second.
+
+import argparse
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def comment_lines(rng):
+    words = ["queue", "element", "insert", "remove", "sort", "merge", "head",
+             "tail", "reverse", "swap", "delete", "middle", "duplicate"]
+    while True:
+        yield "# " + " ".join(rng.choice(words) for _ in range(16)) + "\n"
+
+
+def trace_lines(rng):
+    ops = ["ih", "it"]
+    yield "new\n"
+    size = 0
+    while True:
+        if size > 1000 and rng.random() < 0.5:
+            yield "rh\n"
+            size -= 1
+        else:
+            word = "".join(rng.choice("abcdefghij") for _ in range(8))
+            yield "%s %s\n" % (rng.choice(ops), word)
+            size += 1
+
+
+def write_file(path, kind, size):
+    rng = random.Random(1)
+    gen = comment_lines(rng) if kind == "comment" else trace_lines(rng)
+    lines = 0
+    written = 0
+    with open(path, "w") as f:
+        chunk = []
+        for line in gen:
+            chunk.append(line)
+            written += len(line)
+            lines += 1
+            if len(chunk) == 65536:
+                f.write("".join(chunk))
+                chunk = []
+            if written >= size:
+                break
+        f.write("".join(chunk))
+        f.write("quit\n")
+    return written, lines
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Time qtest reading a large command file")
+    parser.add_argument("-s", "--size", type=int, default=100,
+                        help="size of the file in MB (default 100)")
+    parser.add_argument("-k", "--kind", choices=["comment", "trace"],
+                        default="comment",
+                        help="commands in the file (default comment)")
+    parser.add_argument("-r", "--runs", type=int, default=3,
+                        help="runs, the best of which is reported (default 3)")
+    parser.add_argument("--qtest", default="./qtest",
+                        help="qtest binary (default ./qtest)")
+    args = parser.parse_args()
+
+    fd, path = tempfile.mkstemp(suffix=".cmd")
+    os.close(fd)
+    try:
+        size, lines = write_file(path, args.kind, args.size << 20)
+        best = None
+        for _ in range(args.runs):
+            start = time.perf_counter()
+            rc = subprocess.call([args.qtest, "-v", "0", "-f", path],
+                                 stdout=subprocess.DEVNULL)
+            elapsed = time.perf_counter() - start
+            if rc:
+                sys.exit("qtest failed with status %d" % rc)
+            best = elapsed if best is None else min(best, elapsed)
+    finally:
+        os.unlink(path)
+
+    print("%s: %.1f MB, %d lines in %.2f s: %.1f MB/s, %.0f lines/s" %
+          (args.kind, size / 1e6, lines, best, size / 1e6 / best,
+           lines / best))
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
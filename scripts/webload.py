@@ -0,0 +1,207 @@
+#!/usr/bin/env python3
+
+# Load generator for the web server built into qtest.
+#
+# Start qtest, let it listen, then open many connections at once.  Each
+# connection sends its requests one after the other over the same socket,
+# with up to a given number of them pipelined, i.e. sent before their
+# responses come back.  Report the throughput and the latency distribution
+# of the requests.
+
+import argparse
+import collections
+import errno
+import resource
+import selectors
+import socket
+import subprocess
+import sys
+import time
+
+
+class Client:
+    def __init__(self, sock, requests):
+        self.sock = sock
+        self.unsent = requests
+        self.left = requests
+        self.out = b""
+        self.inp = b""
+        self.starts = collections.deque()
+
+
+def raise_fd_limit(want):
+    soft, hard = resource.getrlimit(resource.RLIMIT_NOFILE)
+    if soft < want and soft != hard:
+        soft = hard if hard == resource.RLIM_INFINITY else min(want, hard)
+        resource.setrlimit(resource.RLIMIT_NOFILE, (soft, hard))
+    return soft
+
+
+def start_qtest(qtest, port, workers):
+    proc = subprocess.Popen([qtest, "-v", "0"],
+                            stdin=subprocess.PIPE,
+                            stdout=subprocess.DEVNULL,
+                            stderr=subprocess.DEVNULL)
+    cmd = "web %d %d" % (port, workers) if workers else "web %d" % port
+    proc.stdin.write(("new\n%s\n" % cmd).encode())
+    proc.stdin.flush()
+    for _ in range(100):
+        try:
+            socket.create_connection(("127.0.0.1", port)).close()
+            return proc
+        except OSError:
+            time.sleep(0.05)
+    proc.kill()
+    sys.exit("qtest does not listen on port %d" % port)
+
+
+# Length of the complete response at the start of buf, 0 if incomplete
+def response_length(buf):
+    end = buf.find(b"\r\n\r\n")
+    if end < 0:
+        return 0
+    length = 0
+    for line in buf[:end].split(b"\r\n")[1:]:
+        name, _, value = line.partition(b":")
+        if name.strip().lower() == b"content-length":
+            length = int(value)
+    total = end + 4 + length
+    return total if len(buf) >= total else 0
+
+
+def run(args):
+    request = ("GET %s HTTP/1.1\r\nHost: localhost\r\n\r\n" %
+               args.path).encode()
+    sel = selectors.DefaultSelector()
+    latencies = []
+    errors = 0
+
+    # Keep up to args.pipeline requests in flight
+    def send(c, now):
+        n = min(c.unsent, args.pipeline - len(c.starts))
+        if n <= 0:
+            return
+        if not c.out:
+            sel.modify(c.sock, selectors.EVENT_READ | selectors.EVENT_WRITE, c)
+        c.out += request * n
+        c.unsent -= n
+        c.starts.extend([now] * n)
+
+    # Open every connection before the first request, so that they are all
+    # held by the server at once
+    clients = []
+    for _ in range(args.connections):
+        s = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        s.setblocking(False)
+        err = s.connect_ex(("127.0.0.1", args.port))
+        if err not in (0, errno.EINPROGRESS):
+            s.close()
+            errors += 1
+            continue
+        c = Client(s, args.requests)
+        clients.append(c)
+        sel.register(s, selectors.EVENT_READ, c)
+
+    begin = time.perf_counter()
+    for c in clients:
+        send(c, begin)
+    active = len(clients)
+    while active:
+        events = sel.select(timeout=args.timeout)
+        if not events:
+            sys.exit("no response for %g seconds, %d connections left" %
+                     (args.timeout, active))
+        for key, mask in events:
+            c = key.data
+            try:
+                if mask & selectors.EVENT_WRITE:
+                    n = c.sock.send(c.out)
+                    c.out = c.out[n:]
+                    if not c.out:
+                        sel.modify(c.sock, selectors.EVENT_READ, c)
+                if not mask & selectors.EVENT_READ:
+                    continue
+                data = c.sock.recv(65536)
+            except BlockingIOError:
+                continue
+            except OSError:
+                data = b""
+            if not data:
+                errors += 1
+                sel.unregister(c.sock)
+                c.sock.close()
+                active -= 1
+                continue
+            c.inp += data
+            now = time.perf_counter()
+            while c.left:
+                n = response_length(c.inp)
+                if not n:
+                    break
+                latencies.append(now - c.starts.popleft())
+                c.inp = c.inp[n:]
+                c.left -= 1
+            if c.left:
+                send(c, now)
+            else:
+                sel.unregister(c.sock)
+                c.sock.close()
+                active -= 1
+    elapsed = time.perf_counter() - begin
+    return latencies, errors, elapsed
+
+
+def percentile(sorted_values, p):
+    i = min(len(sorted_values) - 1, int(p / 100.0 * len(sorted_values)))
+    return sorted_values[i]
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description="Measure the web server of qtest under many connections")
+    parser.add_argument("-c", "--connections", type=int, default=10000,
+                        help="concurrent connections (default 10000)")
+    parser.add_argument("-n", "--requests", type=int, default=10,
+                        help="requests per connection (default 10)")
+    parser.add_argument("-d", "--pipeline", type=int, default=1,
+                        help="requests in flight per connection (default 1)")
+    parser.add_argument("-p", "--port", type=int, default=9999,
+                        help="port to serve on (default 9999)")
+    parser.add_argument("-w", "--workers", type=int, default=0,
+                        help="network threads of qtest (default per CPU)")
+    parser.add_argument("--path", default="/size",
+                        help="URL requested, i.e. the command (default /size)")
+    parser.add_argument("--qtest", default="./qtest",
+                        help="qtest binary (default ./qtest)")
+    parser.add_argument("--timeout", type=float, default=30,
+                        help="seconds to wait for progress (default 30)")
+    args = parser.parse_args()
+
+    limit = raise_fd_limit(args.connections + 64)
+    if limit < args.connections + 64:
+        sys.exit("only %d descriptors allowed, see ulimit -n" % limit)
+
+    proc = start_qtest(args.qtest, args.port, args.workers)
+    try:
+        latencies, errors, elapsed = run(args)
+    finally:
+        proc.stdin.write(b"quit\n")
+        proc.stdin.close()
+        proc.wait()
+
+    latencies.sort()
+    print("%d connections, %d requests each, %d in flight: "
+          "%d responses, %d errors" %
+          (args.connections, args.requests, args.pipeline, len(latencies),
+           errors))
+    if not latencies:
+        return 1
+    print("%.2f s, %.0f requests/s" % (elapsed, len(latencies) / elapsed))
+    print("latency ms: p50 %.2f  p90 %.2f  p99 %.2f  p99.9 %.2f  max %.2f" %
+          tuple(1000 * percentile(latencies, p)
+                for p in (50, 90, 99, 99.9, 100)))
+    return 1 if errors else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,143 @@
+/* Fork-join thread pool used to spread work over several cores */
+
+#include <pthread.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdlib.h>
+
+#include "tpool.h"
+
+struct __tpool {
+    pthread_mutex_t lock;
+    pthread_cond_t work; /* Signaled when a batch starts or on shutdown */
+    pthread_cond_t done; /* Signaled when the last task of a batch ends */
+
+    /* Current batch, protected by lock */
+    tpool_func_t func;
+    void *arg;
+    int ntasks;
+    int next;      /* Index of the next task to hand out */
+    int remaining; /* Tasks not finished yet */
+    unsigned long batch;
+    bool shutdown;
+
+    int nworkers;
+    pthread_t workers[TPOOL_MAX_THREADS - 1];
+};
+
+/* Execute tasks of the current batch until none is left.
+ * Called and returns with pool->lock held.
+ */
+static void run_tasks(tpool_t *pool)
+{
+    while (pool->next < pool->ntasks) {
+        int idx = pool->next++;
+        pthread_mutex_unlock(&pool->lock);
+        pool->func(pool->arg, idx);
+        pthread_mutex_lock(&pool->lock);
+        if (--pool->remaining == 0)
+            pthread_cond_signal(&pool->done);
+    }
+}
+
+static void *worker(void *arg)
+{
+    tpool_t *pool = arg;
+    unsigned long seen = 0;
+
+    pthread_mutex_lock(&pool->lock);
+    for (;;) {
+        while (!pool->shutdown && pool->batch == seen)
+            pthread_cond_wait(&pool->work, &pool->lock);
+        if (pool->shutdown)
+            break;
+        seen = pool->batch;
+        run_tasks(pool);
+    }
+    pthread_mutex_unlock(&pool->lock);
+    return NULL;
+}
+
+tpool_t *tpool_create(int n)
+{
+    if (n < 1 || n > TPOOL_MAX_THREADS)
+        return NULL;
+
+    tpool_t *pool = calloc(1, sizeof(tpool_t));
+    if (!pool)
+        return NULL;
+    pthread_mutex_init(&pool->lock, NULL);
+    pthread_cond_init(&pool->work, NULL);
+    pthread_cond_init(&pool->done, NULL);
+
+    /* Workers inherit a mask blocking every signal */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    for (; pool->nworkers < n - 1; pool->nworkers++) {
+        if (pthread_create(&pool->workers[pool->nworkers], NULL, worker,
+                           pool))
+            break;
+    }
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (pool->nworkers < n - 1) {
+        tpool_destroy(pool);
+        return NULL;
+    }
+    return pool;
+}
+
+void tpool_destroy(tpool_t *pool)
+{
+    if (!pool)
+        return;
+
+    pthread_mutex_lock(&pool->lock);
+    pool->shutdown = true;
+    pthread_cond_broadcast(&pool->work);
+    pthread_mutex_unlock(&pool->lock);
+
+    for (int i = 0; i < pool->nworkers; i++)
+        pthread_join(pool->workers[i], NULL);
+
+    pthread_cond_destroy(&pool->done);
+    pthread_cond_destroy(&pool->work);
+    pthread_mutex_destroy(&pool->lock);
+    free(pool);
+}
+
+int tpool_size(const tpool_t *pool)
+{
+    return pool ? pool->nworkers + 1 : 1;
+}
+
+void tpool_run(tpool_t *pool, tpool_func_t func, void *arg, int ntasks)
+{
+    if (!pool) {
+        for (int i = 0; i < ntasks; i++)
+            func(arg, i);
+        return;
+    }
+
+    sigset_t alrm, old;
+    sigemptyset(&alrm);
+    sigaddset(&alrm, SIGALRM);
+    pthread_sigmask(SIG_BLOCK, &alrm, &old);
+
+    pthread_mutex_lock(&pool->lock);
+    pool->func = func;
+    pool->arg = arg;
+    pool->ntasks = ntasks;
+    pool->next = 0;
+    pool->remaining = ntasks;
+    pool->batch++;
+    pthread_cond_broadcast(&pool->work);
+
+    run_tasks(pool);
+    while (pool->remaining)
+        pthread_cond_wait(&pool->done, &pool->lock);
+    pthread_mutex_unlock(&pool->lock);
+
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
@@ -0,0 +1,34 @@
+#ifndef LAB0_TPOOL_H
+#define LAB0_TPOOL_H
+
+/* A fixed-size pool of worker threads running fork-join batches of tasks.
+ *
+ * Workers are started with every signal blocked, so SIGALRM from the
+ * harness is always delivered to the calling thread.
+ */
+
+/* Upper bound on the number of threads in a pool */
+#define TPOOL_MAX_THREADS 64
+
+typedef struct __tpool tpool_t;
+
+/* Task callback, invoked with the batch argument and the task index */
+typedef void (*tpool_func_t)(void *arg, int idx);
+
+/* Create a pool of n threads, the caller included.  Return NULL on failure */
+tpool_t *tpool_create(int n);
+
+/* Stop the workers and release the pool, no effect if pool is NULL */
+void tpool_destroy(tpool_t *pool);
+
+/* Number of threads taking part in a batch, the caller included */
+int tpool_size(const tpool_t *pool);
+
+/* Run func(arg, i) for every i in [0, ntasks) and wait for all of them.
+ * The calling thread executes tasks as well.  SIGALRM stays blocked in the
+ * caller until the batch completes, so a pending time limit fires only once
+ * no worker touches the data any more.
+ */
+void tpool_run(tpool_t *pool, tpool_func_t func, void *arg, int ntasks);
+
+#endif /* LAB0_TPOOL_H */
@@ -0,0 +1,84 @@
+# Test of unrolled queues: every operation they support, across several nodes
+# and with strings too long to be kept inline, and the ones they reject
+option fail 0
+option malloc 0
+new unrolled
+ih gerbil
+ih bear
+ih dolphin
+it meerkat
+it zorilla-with-a-name-too-long-to-be-kept-inline-in-the-node
+size
+rh dolphin
+rt zorilla-with-a-name-too-long-to-be-kept-inline-in-the-node
+swap
+reverse
+rh meerkat
+rh bear
+rh gerbil
+size
+it zebra 40
+ih ant 40
+it zorilla-with-a-name-too-long-to-be-kept-inline-in-the-node 3
+it yak
+size
+dm
+reverseK 3
+sort
+rh ant
+rt zorilla-with-a-name-too-long-to-be-kept-inline-in-the-node
+option descend 1
+sort
+rh zorilla-with-a-name-too-long-to-be-kept-inline-in-the-node
+rt ant
+dedup
+option descend 0
+size
+rh zorilla-with-a-name-too-long-to-be-kept-inline-in-the-node
+rh yak
+size
+ih cat
+ih fox
+it cat
+ascend
+rh cat
+rh cat
+ih fox
+it cat
+descend
+rh fox
+rh cat
+size
+free
+new unrolled
+it bear 20
+it gerbil 20
+new unrolled
+it ant 30
+it dolphin 30
+new unrolled
+it cat 40
+it meerkat
+merge
+size
+rh ant
+rhn 29
+rh bear
+rhn 19
+rt meerkat
+rt gerbil
+size
+new
+mustfail merge
+free
+mustfail listsort
+mustfail radixsort
+mustfail dedupall
+mustfail compact
+mustfail shuffle
+option simulation 1
+mustfail it
+mustfail rh
+option simulation 0
+size
+free
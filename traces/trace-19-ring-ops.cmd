@@ -0,0 +1,10 @@
+# Test of insert_head and remove_head on a ring queue
+option fail 0
+option malloc 0
+new ring 4096
+ih gerbil
+ih bear
+ih dolphin
+rh dolphin
+rh bear
+rh gerbil
@@ -0,0 +1,6 @@
+# Test remove_head with NULL argument on a ring queue
+option fail 10
+option malloc 0
+new ring 4096
+ih bear
+rh
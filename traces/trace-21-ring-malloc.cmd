@@ -0,0 +1,6 @@
+# Test of malloc failure on insert_head on a ring queue
+option fail 30
+option malloc 0
+new ring 4096
+option malloc 25
+ih gerbil 20
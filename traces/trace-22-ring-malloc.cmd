@@ -0,0 +1,7 @@
+# Test of malloc failure on insert_tail on a ring queue
+option fail 50
+option malloc 0
+new ring 4096
+ih jaguar 20
+option malloc 25
+it gerbil 20
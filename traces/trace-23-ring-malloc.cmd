@@ -0,0 +1,9 @@
+# Test of malloc failure on new ring queues
+option fail 10
+option malloc 50
+new ring 4096
+new ring 4096
+new ring 4096
+new ring 4096
+new ring 4096
+new ring 4096
@@ -0,0 +1,9 @@
+# Test if time complexity of ring_insert_tail, ring_insert_head, ring_remove_tail,
+# and ring_remove_head is constant
+new ring 16
+option simulation 1
+it
+ih
+rh
+rt
+option simulation 0
@@ -0,0 +1,43 @@
+# Test of radixsort in ascending and descending order, with duplicates,
+# strings that are prefixes of others and strings longer than 32 bytes
+option fail 0
+option malloc 0
+new
+it radix-sorts-strings-by-their-bytes-bee 20
+it rad 10
+it radix-sorts-strings-by-their-bytes-ant 20
+it radix 10
+ih zebra 3
+it ra 5
+it radix-sorts-strings-by-their-bytes-bee 5
+it radix-sorts-strings-by-their-bytes 5
+size
+shuffle
+radixsort
+rh ra
+rhn 4
+rh rad
+rhn 9
+rh radix
+rhn 9
+rh radix-sorts-strings-by-their-bytes
+rhn 4
+rh radix-sorts-strings-by-their-bytes-ant
+rt zebra
+rt zebra
+size
+ih ra 5
+it radix 40
+option descend 1
+radixsort
+rh zebra
+rh radix-sorts-strings-by-their-bytes-bee
+rhn 24
+rh radix-sorts-strings-by-their-bytes-ant
+rhn 18
+rt ra
+rhn 39
+rh radix
+size
+free
+option descend 0
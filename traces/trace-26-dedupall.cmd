@@ -0,0 +1,39 @@
+# Test of dedupall, deleting every string that occurs more than once in any
+# order, and of it failing to allocate its table
+option fail 10
+option malloc 0
+new
+it gerbil
+it bear
+it dolphin
+it bear
+it meerkat
+it gerbil
+it bear
+it zebra
+dedupall
+size
+rh dolphin
+rh meerkat
+rh zebra
+dedupall
+it fish 40
+it eel
+ih fish
+it owl 3
+it cat
+dedupall
+rh eel
+rh cat
+size
+it bear
+it dolphin
+it bear
+option malloc 100
+dedupall
+option malloc 0
+rh bear
+rh dolphin
+rh bear
+dedupall
+free
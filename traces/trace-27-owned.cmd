@@ -0,0 +1,36 @@
+# Test of insert_head and insert_tail handing their strings over to the queue
+# with option owned 1, and of malloc failure meanwhile
+option fail 50
+option malloc 0
+option owned 1
+new
+ih gerbil
+ih bear
+ih dolphin
+it meerkat
+it bear
+it gerbil
+it tiger
+rt tiger
+dm
+dm
+it meerkat
+rh dolphin
+rh bear
+rh bear
+rh gerbil
+rh meerkat
+ih RAND 10
+it aardvark_bear_dolphin_gerbil_jaguar 5
+ih meerkat_panda_squirrel_vulture_wolf 5
+rt aardvark_bear_dolphin_gerbil_jaguar
+rh meerkat_panda_squirrel_vulture_wolf
+sort
+free
+new
+option malloc 25
+ih gerbil 20
+it RAND 20
+option malloc 0
+free
+option owned 0
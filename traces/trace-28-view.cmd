@@ -0,0 +1,41 @@
+# Test of remove_head and remove_tail lending the strings of removed elements
+# with option view 1, including truncated copies and an empty queue
+option fail 10
+option malloc 0
+option view 1
+new
+ih gerbil
+ih bear
+ih dolphin
+it meerkat
+it bear
+it gerbil
+it tiger
+rt tiger
+dm
+dm
+it meerkat
+rh dolphin
+rh bear
+rh bear
+rh gerbil
+rh meerkat
+rh
+rt
+ih aardvark_bear_dolphin_gerbil_jaguar 3
+it meerkat_panda_squirrel_vulture_wolf 3
+rh aardvark_bear_dolphin_gerbil_jaguar
+rt meerkat_panda_squirrel_vulture_wolf
+option length 21
+rh aardvark_bear_dolphin
+option length 22
+rt meerkat_panda_squirrel
+option length 7
+rt meerkat
+option length 8
+rh aardvark
+option length 1024
+it RAND 5
+rhn 5
+free
+option view 0
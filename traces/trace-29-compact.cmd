@@ -0,0 +1,33 @@
+# Test of compact, moving the nodes and strings of a queue next to each other
+# in list order, by hand and after sort with option compact 1
+option fail 0
+option malloc 0
+new
+it RAND 20000
+shuffle
+compact
+sort
+free
+new
+it dolphin 3000
+it bear 3000
+ih zebra 3000
+it a_name_longer_than_the_inline_key_of_an_element 3000
+shuffle
+compact
+option compact 1
+sort
+show
+rh a_name_longer_than_the_inline_key_of_an_element
+rh a_name_longer_than_the_inline_key_of_an_element
+rt zebra
+shuffle
+option descend 1
+sort
+rh zebra
+rt a_name_longer_than_the_inline_key_of_an_element
+size
+option descend 0
+option compact 0
+compact
+free
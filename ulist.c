@@ -0,0 +1,698 @@
+/* Queue of strings kept in an unrolled linked list */
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "compare.h"
+#include "harness.h"
+#include "list.h"
+#include "ulist.h"
+
+/* Strings per chunk */
+#define UL_CHUNK_SLOTS 32
+
+/* Strings shorter than this are kept inside their slot */
+#define UL_INLINE_LEN 16
+
+/**
+ * ul_slot_t - One string of an unrolled queue
+ * @inl: the string itself, null terminated, if @len < UL_INLINE_LEN
+ * @heap: block holding the string otherwise
+ * @len: strlen() of the string
+ */
+typedef struct {
+    union {
+        char inl[UL_INLINE_LEN];
+        char *heap;
+    };
+    size_t len;
+} ul_slot_t;
+
+/**
+ * ul_chunk_t - Node of the unrolled list
+ * @list: node of the list of chunks
+ * @start: index of the first slot in use
+ * @count: number of slots in use, which follow each other from @start
+ * @slot: strings, in queue order
+ *
+ * Every chunk in the list holds at least one string.
+ */
+typedef struct {
+    struct list_head list;
+    unsigned start, count;
+    ul_slot_t slot[UL_CHUNK_SLOTS];
+} ul_chunk_t;
+
+/* Chunks emptied by sort and merge, which may not free them, are kept on
+ * the spare list for later insertions, as is one emptied by a removal so
+ * that a queue going back and forth across a chunk boundary does not call
+ * malloc and free every time.
+ */
+struct __ulist {
+    struct list_head chunks;
+    struct list_head spare;
+    size_t size;
+};
+
+/* Position of a string in an unrolled queue */
+typedef struct {
+    ul_chunk_t *c;
+    unsigned i;
+} ul_pos_t;
+
+static inline unsigned chunk_end(const ul_chunk_t *c)
+{
+    return c->start + c->count;
+}
+
+static inline ul_chunk_t *chunk_next(const ul_chunk_t *c)
+{
+    return list_entry(c->list.next, ul_chunk_t, list);
+}
+
+static inline ul_chunk_t *chunk_prev(const ul_chunk_t *c)
+{
+    return list_entry(c->list.prev, ul_chunk_t, list);
+}
+
+static inline const char *slot_str(const ul_slot_t *s)
+{
+    return s->len < UL_INLINE_LEN ? s->inl : s->heap;
+}
+
+/* Store a copy of s, of length len, into slot.
+ * Return false if could not allocate space.
+ */
+static bool slot_fill(ul_slot_t *slot, const char *s, size_t len)
+{
+    char *dst = slot->inl;
+    if (len >= UL_INLINE_LEN && !(dst = slot->heap = malloc(len + 1)))
+        return false;
+    memcpy(dst, s, len + 1);
+    slot->len = len;
+    return true;
+}
+
+static inline void slot_release(ul_slot_t *slot)
+{
+    if (slot->len >= UL_INLINE_LEN)
+        free(slot->heap);
+}
+
+/* Copy the string of slot to sp, truncated to bufsize - 1 characters, then
+ * release it
+ */
+static void slot_take(ul_slot_t *slot, char *sp, size_t bufsize)
+{
+    if (sp) {
+        size_t n = slot->len < bufsize - 1 ? slot->len : bufsize - 1;
+        memcpy(sp, slot_str(slot), n);
+        sp[n] = '\0';
+    }
+    slot_release(slot);
+}
+
+static inline void slot_swap(ul_slot_t *a, ul_slot_t *b)
+{
+    ul_slot_t tmp = *a;
+    *a = *b;
+    *b = tmp;
+}
+
+static inline int slot_cmp(const ul_slot_t *a, const ul_slot_t *b)
+{
+    return compare_strings(slot_str(a), a->len, slot_str(b), b->len);
+}
+
+static inline bool slot_equal(const ul_slot_t *a, const ul_slot_t *b)
+{
+    return a->len == b->len &&
+           compare_diff(slot_str(a), slot_str(b), a->len) == a->len;
+}
+
+/* Get an empty chunk, preferring a spare one.  NULL on failure */
+static ul_chunk_t *chunk_get(ulist_t *ul)
+{
+    if (list_empty(&ul->spare))
+        return malloc(sizeof(ul_chunk_t));
+
+    ul_chunk_t *c = list_first_entry(&ul->spare, ul_chunk_t, list);
+    list_del(&c->list);
+    return c;
+}
+
+/* Take c, which holds no string any more, out of the queue */
+static void chunk_drop(ulist_t *ul, ul_chunk_t *c)
+{
+    if (list_empty(&ul->spare)) {
+        list_move(&c->list, &ul->spare);
+    } else {
+        list_del(&c->list);
+        free(c);
+    }
+}
+
+/* Remove the string in slot i of c, shifting whichever side of it is
+ * shorter
+ */
+static void chunk_erase(ulist_t *ul, ul_chunk_t *c, unsigned i)
+{
+    slot_release(&c->slot[i]);
+    if (i - c->start < chunk_end(c) - 1 - i) {
+        memmove(&c->slot[c->start + 1], &c->slot[c->start],
+                (i - c->start) * sizeof(ul_slot_t));
+        c->start++;
+    } else {
+        memmove(&c->slot[i], &c->slot[i + 1],
+                (chunk_end(c) - 1 - i) * sizeof(ul_slot_t));
+    }
+    if (!--c->count)
+        chunk_drop(ul, c);
+}
+
+static void chunk_reverse(ul_chunk_t *c)
+{
+    for (unsigned i = c->start, j = chunk_end(c) - 1; i < j; i++, j--)
+        slot_swap(&c->slot[i], &c->slot[j]);
+}
+
+/* Sort the strings of c by insertion, ascending if sign is 1 and descending
+ * if it is -1
+ */
+static void chunk_sort(ul_chunk_t *c, int sign)
+{
+    for (unsigned i = c->start + 1; i < chunk_end(c); i++) {
+        ul_slot_t s = c->slot[i];
+        unsigned j = i;
+        for (; j > c->start && sign * slot_cmp(&c->slot[j - 1], &s) > 0; j--)
+            c->slot[j] = c->slot[j - 1];
+        c->slot[j] = s;
+    }
+}
+
+/* Step to the next/previous string, which must exist */
+static inline void pos_next(ul_pos_t *p)
+{
+    if (++p->i == chunk_end(p->c)) {
+        p->c = chunk_next(p->c);
+        p->i = p->c->start;
+    }
+}
+
+static inline void pos_prev(ul_pos_t *p)
+{
+    if (p->i == p->c->start) {
+        p->c = chunk_prev(p->c);
+        p->i = chunk_end(p->c);
+    }
+    p->i--;
+}
+
+/* Step n strings ahead, a chunk at a time.  There must be more than n
+ * strings from p on.
+ */
+static void pos_advance(ul_pos_t *p, size_t n)
+{
+    while (n >= chunk_end(p->c) - p->i) {
+        n -= chunk_end(p->c) - p->i;
+        p->c = chunk_next(p->c);
+        p->i = p->c->start;
+    }
+    p->i += n;
+}
+
+/* Writer packing the strings a pass over a queue keeps into its chunks,
+ * from the start of the first one on.  The writer never gets ahead of the
+ * pass, since every chunk before the one being read holds at most
+ * UL_CHUNK_SLOTS strings.
+ */
+typedef struct {
+    ulist_t *ul;
+    ul_chunk_t *c;
+    unsigned n;
+    size_t size;
+} ul_writer_t;
+
+static void writer_init(ul_writer_t *w, ulist_t *ul)
+{
+    w->ul = ul;
+    w->c = list_first_entry(&ul->chunks, ul_chunk_t, list);
+    w->n = 0;
+    w->size = 0;
+}
+
+static inline void writer_put(ul_writer_t *w, const ul_slot_t *s)
+{
+    if (w->n == UL_CHUNK_SLOTS) {
+        w->c->start = 0;
+        w->c->count = UL_CHUNK_SLOTS;
+        w->c = chunk_next(w->c);
+        w->n = 0;
+    }
+    w->c->slot[w->n++] = *s;
+    w->size++;
+}
+
+/* Drop the chunks past the last string written */
+static void writer_finish(ul_writer_t *w)
+{
+    ulist_t *ul = w->ul;
+    ul_chunk_t *c = w->c;
+    if (w->n) {
+        c->start = 0;
+        c->count = w->n;
+        c = chunk_next(c);
+    }
+    while (&c->list != &ul->chunks) {
+        ul_chunk_t *next = chunk_next(c);
+        chunk_drop(ul, c);
+        c = next;
+    }
+    ul->size = w->size;
+}
+
+/* Move the chunks of the sorted run at the front of src to the tail of dst */
+static void take_run(struct list_head *src, struct list_head *dst, int sign)
+{
+    while (!list_empty(src)) {
+        ul_chunk_t *c = list_first_entry(src, ul_chunk_t, list);
+        list_move_tail(&c->list, dst);
+        if (list_empty(src))
+            break;
+        ul_chunk_t *next = list_first_entry(src, ul_chunk_t, list);
+        if (sign * slot_cmp(&c->slot[chunk_end(c) - 1],
+                            &next->slot[next->start]) > 0)
+            break;
+    }
+}
+
+/* Move the first of n buffered strings, up to a chunk of them, into a spare
+ * chunk appended to out.  Return the number of strings left in buf.
+ */
+static unsigned flush_chunk(ul_slot_t *buf,
+                            unsigned n,
+                            struct list_head *spare,
+                            struct list_head *out)
+{
+    ul_chunk_t *c = list_first_entry(spare, ul_chunk_t, list);
+    unsigned k = n < UL_CHUNK_SLOTS ? n : UL_CHUNK_SLOTS;
+    memcpy(c->slot, buf, k * sizeof(ul_slot_t));
+    memmove(buf, buf + k, (n - k) * sizeof(ul_slot_t));
+    c->start = 0;
+    c->count = k;
+    list_move_tail(&c->list, out);
+    return n - k;
+}
+
+/* Merge the sorted runs of chunks a and b, both non-empty, into chunks
+ * appended to out, putting the strings of a first among equal ones.
+ *
+ * Chunks go to spare as soon as all their strings have been taken, and the
+ * output is written into spare chunks, so nothing is allocated.  Strings
+ * wait in a buffer of two chunks' worth of slots until a spare chunk turns
+ * up.  One always has by the time the buffer is full: of the strings taken
+ * so far, at most two partly read chunks hold fewer than 2 * UL_CHUNK_SLOTS,
+ * so more chunks have been emptied than filled.
+ */
+static void merge_runs(struct list_head *a,
+                       struct list_head *b,
+                       struct list_head *out,
+                       struct list_head *spare,
+                       int sign)
+{
+    ul_slot_t buf[2 * UL_CHUNK_SLOTS];
+    unsigned n = 0;
+    ul_pos_t pa = {list_first_entry(a, ul_chunk_t, list), 0};
+    ul_pos_t pb = {list_first_entry(b, ul_chunk_t, list), 0};
+    pa.i = pa.c->start;
+    pb.i = pb.c->start;
+
+    while (!list_empty(a) || !list_empty(b)) {
+        bool from_a =
+            list_empty(b) ||
+            (!list_empty(a) &&
+             sign * slot_cmp(&pa.c->slot[pa.i], &pb.c->slot[pb.i]) <= 0);
+        ul_pos_t *p = from_a ? &pa : &pb;
+        struct list_head *run = from_a ? a : b;
+
+        buf[n++] = p->c->slot[p->i];
+        if (++p->i == chunk_end(p->c)) {
+            list_move_tail(&p->c->list, spare);
+            if (!list_empty(run)) {
+                p->c = list_first_entry(run, ul_chunk_t, list);
+                p->i = p->c->start;
+            }
+        }
+        if (n >= UL_CHUNK_SLOTS && !list_empty(spare))
+            n = flush_chunk(buf, n, spare, out);
+    }
+    while (n)
+        n = flush_chunk(buf, n, spare, out);
+}
+
+ulist_t *ul_new(void)
+{
+    ulist_t *ul = malloc(sizeof(ulist_t));
+    if (!ul)
+        return NULL;
+
+    INIT_LIST_HEAD(&ul->chunks);
+    INIT_LIST_HEAD(&ul->spare);
+    ul->size = 0;
+    return ul;
+}
+
+void ul_free(ulist_t *ul)
+{
+    if (!ul)
+        return;
+
+    ul_chunk_t *c, *safe;
+    list_for_each_entry_safe (c, safe, &ul->chunks, list) {
+        for (unsigned i = c->start; i < chunk_end(c); i++)
+            slot_release(&c->slot[i]);
+        free(c);
+    }
+    list_for_each_entry_safe (c, safe, &ul->spare, list)
+        free(c);
+    free(ul);
+}
+
+bool ul_insert_head(ulist_t *ul, const char *s)
+{
+    ul_slot_t slot;
+    if (!ul || !slot_fill(&slot, s, strlen(s)))
+        return false;
+
+    ul_chunk_t *c = list_first_entry(&ul->chunks, ul_chunk_t, list);
+    if (list_empty(&ul->chunks) || !c->start) {
+        if (!(c = chunk_get(ul))) {
+            slot_release(&slot);
+            return false;
+        }
+        c->start = UL_CHUNK_SLOTS;
+        c->count = 0;
+        list_add(&c->list, &ul->chunks);
+    }
+    c->slot[--c->start] = slot;
+    c->count++;
+    ul->size++;
+    return true;
+}
+
+bool ul_insert_tail(ulist_t *ul, const char *s)
+{
+    ul_slot_t slot;
+    if (!ul || !slot_fill(&slot, s, strlen(s)))
+        return false;
+
+    ul_chunk_t *c = list_last_entry(&ul->chunks, ul_chunk_t, list);
+    if (list_empty(&ul->chunks) || chunk_end(c) == UL_CHUNK_SLOTS) {
+        if (!(c = chunk_get(ul))) {
+            slot_release(&slot);
+            return false;
+        }
+        c->start = 0;
+        c->count = 0;
+        list_add_tail(&c->list, &ul->chunks);
+    }
+    c->slot[chunk_end(c)] = slot;
+    c->count++;
+    ul->size++;
+    return true;
+}
+
+bool ul_remove_head(ulist_t *ul, char *sp, size_t bufsize)
+{
+    if (!ul || !ul->size)
+        return false;
+
+    ul_chunk_t *c = list_first_entry(&ul->chunks, ul_chunk_t, list);
+    slot_take(&c->slot[c->start++], sp, bufsize);
+    if (!--c->count)
+        chunk_drop(ul, c);
+    ul->size--;
+    return true;
+}
+
+bool ul_remove_tail(ulist_t *ul, char *sp, size_t bufsize)
+{
+    if (!ul || !ul->size)
+        return false;
+
+    ul_chunk_t *c = list_last_entry(&ul->chunks, ul_chunk_t, list);
+    slot_take(&c->slot[chunk_end(c) - 1], sp, bufsize);
+    if (!--c->count)
+        chunk_drop(ul, c);
+    ul->size--;
+    return true;
+}
+
+size_t ul_size(const ulist_t *ul)
+{
+    return ul ? ul->size : 0;
+}
+
+bool ul_delete_mid(ulist_t *ul)
+{
+    if (!ul || !ul->size)
+        return false;
+
+    /* Count chunks from whichever end is nearer to the middle */
+    size_t mid = ul->size / 2, back = ul->size - 1 - mid;
+    ul_chunk_t *c;
+    unsigned i;
+    if (mid <= back) {
+        for (c = list_first_entry(&ul->chunks, ul_chunk_t, list);
+             mid >= c->count; c = chunk_next(c))
+            mid -= c->count;
+        i = c->start + mid;
+    } else {
+        for (c = list_last_entry(&ul->chunks, ul_chunk_t, list);
+             back >= c->count; c = chunk_prev(c))
+            back -= c->count;
+        i = chunk_end(c) - 1 - back;
+    }
+    chunk_erase(ul, c, i);
+    ul->size--;
+    return true;
+}
+
+bool ul_delete_dup(ulist_t *ul)
+{
+    if (!ul || !ul->size)
+        return false;
+
+    /* The first of a run of equal strings waits in prev until the next
+     * string tells whether the run is longer than one
+     */
+    ul_writer_t w;
+    writer_init(&w, ul);
+    ul_slot_t prev = {.len = 0};
+    bool have = false, dup = false;
+    ul_chunk_t *c, *safe;
+    list_for_each_entry_safe (c, safe, &ul->chunks, list) {
+        for (unsigned i = c->start, end = chunk_end(c); i < end; i++) {
+            ul_slot_t *s = &c->slot[i];
+            if (have && slot_equal(&prev, s)) {
+                slot_release(s);
+                dup = true;
+                continue;
+            }
+            if (have && dup)
+                slot_release(&prev);
+            else if (have)
+                writer_put(&w, &prev);
+            prev = *s;
+            have = true;
+            dup = false;
+        }
+    }
+    if (dup)
+        slot_release(&prev);
+    else
+        writer_put(&w, &prev);
+    writer_finish(&w);
+    return true;
+}
+
+void ul_reverseK(ulist_t *ul, int k)
+{
+    if (!ul || k < 2 || ul->size < (size_t) k)
+        return;
+
+    ul_chunk_t *first = list_first_entry(&ul->chunks, ul_chunk_t, list);
+    ul_pos_t group = {first, first->start};
+    for (size_t left = ul->size;;) {
+        ul_pos_t lo = group, hi = group;
+        pos_advance(&hi, k - 1);
+        group = hi;
+        for (int n = k / 2; n; n--) {
+            slot_swap(&lo.c->slot[lo.i], &hi.c->slot[hi.i]);
+            if (n > 1) {
+                pos_next(&lo);
+                pos_prev(&hi);
+            }
+        }
+        left -= k;
+        if (left < (size_t) k)
+            break;
+        pos_next(&group);
+    }
+}
+
+void ul_swap(ulist_t *ul)
+{
+    ul_reverseK(ul, 2);
+}
+
+void ul_reverse(ulist_t *ul)
+{
+    if (!ul)
+        return;
+
+    ul_chunk_t *c, *safe;
+    list_for_each_entry_safe (c, safe, &ul->chunks, list) {
+        chunk_reverse(c);
+        list_move(&c->list, &ul->chunks);
+    }
+}
+
+void ul_sort(ulist_t *ul, bool descend)
+{
+    if (!ul || ul->size < 2)
+        return;
+
+    /* Natural merge sort of the chunks, each sorted on its own first */
+    int sign = descend ? -1 : 1;
+    ul_chunk_t *c;
+    list_for_each_entry (c, &ul->chunks, list)
+        chunk_sort(c, sign);
+
+    size_t runs;
+    do {
+        LIST_HEAD(out);
+        runs = 0;
+        while (!list_empty(&ul->chunks)) {
+            LIST_HEAD(a);
+            LIST_HEAD(b);
+            take_run(&ul->chunks, &a, sign);
+            take_run(&ul->chunks, &b, sign);
+            if (list_empty(&b))
+                list_splice_tail(&a, &out);
+            else
+                merge_runs(&a, &b, &out, &ul->spare, sign);
+            runs++;
+        }
+        list_splice(&out, &ul->chunks);
+    } while (runs > 1);
+}
+
+/* Delete every string that some string after it is ordered before, the
+ * order being ascending if sign is 1 and descending if it is -1.  Kept
+ * strings are those ordered no later than all strings after them, so the
+ * pass runs over the reversed queue, keeping each string ordered no later
+ * than the last one kept.
+ */
+static size_t ul_monotone(ulist_t *ul, int sign)
+{
+    if (!ul || !ul->size)
+        return 0;
+
+    ul_reverse(ul);
+    ul_writer_t w;
+    writer_init(&w, ul);
+    ul_slot_t last = {.len = 0};
+    bool have = false;
+    ul_chunk_t *c, *safe;
+    list_for_each_entry_safe (c, safe, &ul->chunks, list) {
+        for (unsigned i = c->start, end = chunk_end(c); i < end; i++) {
+            if (have && sign * slot_cmp(&c->slot[i], &last) > 0) {
+                slot_release(&c->slot[i]);
+                continue;
+            }
+            last = c->slot[i];
+            have = true;
+            writer_put(&w, &last);
+        }
+    }
+    writer_finish(&w);
+    ul_reverse(ul);
+    return ul->size;
+}
+
+size_t ul_ascend(ulist_t *ul)
+{
+    return ul_monotone(ul, 1);
+}
+
+size_t ul_descend(ulist_t *ul)
+{
+    return ul_monotone(ul, -1);
+}
+
+size_t ul_merge(ulist_t *dst, ulist_t *src, bool descend)
+{
+    if (!dst)
+        return 0;
+    if (!src || src == dst || !src->size)
+        return dst->size;
+
+    if (!dst->size) {
+        list_splice_init(&src->chunks, &dst->chunks);
+    } else {
+        LIST_HEAD(a);
+        list_splice_init(&dst->chunks, &a);
+        merge_runs(&a, &src->chunks, &dst->chunks, &dst->spare,
+                   descend ? -1 : 1);
+    }
+    list_splice_tail_init(&src->spare, &dst->spare);
+    dst->size += src->size;
+    src->size = 0;
+    return dst->size;
+}
+
+const char *ul_head(const ulist_t *ul)
+{
+    if (!ul || !ul->size)
+        return NULL;
+
+    const ul_chunk_t *c = list_first_entry(&ul->chunks, ul_chunk_t, list);
+    return slot_str(&c->slot[c->start]);
+}
+
+const char *ul_tail(const ulist_t *ul)
+{
+    if (!ul || !ul->size)
+        return NULL;
+
+    const ul_chunk_t *c = list_last_entry(&ul->chunks, ul_chunk_t, list);
+    return slot_str(&c->slot[chunk_end(c) - 1]);
+}
+
+void ul_iter_init(ul_iter_t *it, const ulist_t *ul)
+{
+    const ul_chunk_t *c =
+        ul && ul->size ? list_first_entry(&ul->chunks, ul_chunk_t, list)
+                       : NULL;
+    it->ul = ul;
+    it->chunk = c;
+    it->slot = c ? c->start : 0;
+}
+
+const char *ul_iter_next(ul_iter_t *it, size_t *len)
+{
+    const ul_chunk_t *c = it->chunk;
+    if (!c)
+        return NULL;
+
+    const ul_slot_t *s = &c->slot[it->slot];
+    if (++it->slot == chunk_end(c)) {
+        c = c->list.next == &it->ul->chunks ? NULL : chunk_next(c);
+        it->chunk = c;
+        it->slot = c ? c->start : 0;
+    }
+    if (len)
+        *len = s->len;
+    return slot_str(s);
+}
@@ -0,0 +1,108 @@
+#ifndef LAB0_ULIST_H
+#define LAB0_ULIST_H
+
+/* A queue of strings kept in an unrolled linked list.
+ *
+ * Each node of the list is a chunk holding up to 32 strings in order.
+ * Strings of up to 15 characters are stored inside their slot of the chunk,
+ * longer ones in a block of their own.  A queue of short strings thus costs
+ * 24 bytes and a thirty-second of a chunk header per string, where a list
+ * queue needs an element, a string block and the allocator overhead of both.
+ *
+ * The operations mirror those of queue.h.  There is no element_t to hand
+ * out, so removals copy the string out and release it at once.
+ */
+
+#include <stdbool.h>
+#include <stddef.h>
+
+typedef struct __ulist ulist_t;
+
+/* Position in an unrolled queue, for walking its strings in order */
+typedef struct {
+    const ulist_t *ul;
+    const void *chunk;
+    unsigned slot;
+} ul_iter_t;
+
+/* Create an empty queue.  Return NULL if could not allocate space */
+ulist_t *ul_new(void);
+
+/* Free a queue and every string in it, no effect if ul is NULL */
+void ul_free(ulist_t *ul);
+
+/* Insert a copy of s at the head, like q_insert_head().
+ * Return false if ul is NULL or could not allocate space.
+ */
+bool ul_insert_head(ulist_t *ul, const char *s);
+
+/* Insert a copy of s at the tail, like q_insert_tail().
+ * Return false if ul is NULL or could not allocate space.
+ */
+bool ul_insert_tail(ulist_t *ul, const char *s);
+
+/* Remove the string at the head.  If sp is non-NULL, copy it to *sp, up to
+ * bufsize - 1 characters plus a null terminator.
+ * Return false if ul is NULL or empty.
+ */
+bool ul_remove_head(ulist_t *ul, char *sp, size_t bufsize);
+
+/* Remove the string at the tail, like ul_remove_head() */
+bool ul_remove_tail(ulist_t *ul, char *sp, size_t bufsize);
+
+/* Number of strings in the queue, 0 if ul is NULL */
+size_t ul_size(const ulist_t *ul);
+
+/* Delete the middle string, like q_delete_mid().
+ * Return false if ul is NULL or empty.
+ */
+bool ul_delete_mid(ulist_t *ul);
+
+/* Delete every string of a sorted queue that has a duplicate, like
+ * q_delete_dup().  Return false if ul is NULL or empty.
+ */
+bool ul_delete_dup(ulist_t *ul);
+
+/* Swap every two adjacent strings, like q_swap() */
+void ul_swap(ulist_t *ul);
+
+/* Reverse the queue, like q_reverse() */
+void ul_reverse(ulist_t *ul);
+
+/* Reverse the strings k at a time, like q_reverseK() */
+void ul_reverseK(ulist_t *ul, int k);
+
+/* Sort the queue in ascending/descending order, keeping equal strings in
+ * their order, like q_sort().  No memory is allocated or freed.
+ */
+void ul_sort(ulist_t *ul, bool descend);
+
+/* Delete every string with a strictly less one anywhere after it, like
+ * q_ascend().  Return the number of strings left.
+ */
+size_t ul_ascend(ulist_t *ul);
+
+/* Delete every string with a strictly greater one anywhere after it, like
+ * q_descend().  Return the number of strings left.
+ */
+size_t ul_descend(ulist_t *ul);
+
+/* Merge src, sorted the same way as dst, into dst, leaving src empty.  No
+ * memory is allocated or freed.  Return the number of strings in dst.
+ */
+size_t ul_merge(ulist_t *dst, ulist_t *src, bool descend);
+
+/* String at the head/tail of the queue, NULL if ul is NULL or empty */
+const char *ul_head(const ulist_t *ul);
+const char *ul_tail(const ulist_t *ul);
+
+/* Start walking ul from its head */
+void ul_iter_init(ul_iter_t *it, const ulist_t *ul);
+
+/* Next string of the walk, storing its length to *len if len is non-NULL.
+ * Return NULL once every string has been visited.  The queue must not
+ * change during the walk.
+ */
+const char *ul_iter_next(ul_iter_t *it, size_t *len);
+
+#endif /* LAB0_ULIST_H */
@@ -4,128 +4,459 @@
 
 #include <arpa/inet.h> /* inet_ntoa */
 #include <errno.h>
+#include <fcntl.h>
 #include <netinet/tcp.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdatomic.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <strings.h>
+#include <sys/resource.h>
 #include <sys/socket.h>
 #include <unistd.h>
 
-#define LISTENQ 1024 /* second argument to listen() */
-#define MAXLINE 1024 /* max length of a line */
-#define BUFSIZE 1024
+#ifdef __linux__
+#include <sys/epoll.h>
+#endif
+
+#include "list.h" /* container_of */
+#include "rio.h"
+#include "web.h"
+
+#define LISTENQ 4096    /* second argument to listen() */
+#define MAXLINE 1024    /* max length of a line */
+#define CMDSIZE 8192    /* max length of a command, as on the console */
+#define BUFSIZE 1024    /* initial size of the input buffer */
+#define REQ_MAX 65536   /* max length of a request, headers included */
+#define MAX_EVENTS 256  /* events taken from the poller at once */
+#define OUT_KEEP 65536  /* largest response buffer kept between requests */
+#define ACCEPT_MAX 64   /* connections a worker accepts at once */
+#define WORKERS_MAX 8   /* max number of network threads */
+#define ACCEPT_RETRY 100 /* ms between accepts while out of descriptors */
 
 #ifndef DEFAULT_PORT
 #define DEFAULT_PORT 9999 /* use this port if none given as arg to main() */
 #endif
 
-#if defined(__APPLE__) || defined(__FreeBSD__)
-#define TCP_CORK TCP_NOPUSH
-#endif
+/* A connection goes through these states for every command it sends.
+ * Clients may send requests without waiting for responses, so input is
+ * still read while a command waits, and the responses to requests that
+ * arrived together go out together.
+ *
+ * A GET request carries a single command in its URL.  A POST request
+ * carries a batch of them, one per line of its body like a .cmd file.
+ * They run as their lines arrive, each output being sent as a chunk of
+ * a single response.
+ */
+typedef enum {
+    CONN_READING, /* Waiting for a complete request */
+    CONN_PENDING, /* Command queued or running */
+    CONN_WRITING, /* Waiting for room to send responses */
+} conn_state_t;
 
-typedef struct {
-    int fd;            /* descriptor for this buf */
-    int count;         /* unread byte in this buf */
-    char *bufptr;      /* next unread byte in this buf */
-    char buf[BUFSIZE]; /* internal buffer */
-} rio_t;
+/* Link of a connection in a conn_queue_t */
+typedef struct __conn_node {
+    _Atomic(struct __conn_node *) next;
+} conn_node_t;
 
+/* Connections handed from one thread to another.  Any thread may push, a
+ * single one pops, after Dmitry Vyukov's intrusive MPSC queue: a push is an
+ * atomic exchange and a store, a pop takes no atomic read-modify-write
+ * unless it empties the queue, and nothing is allocated as connections
+ * carry their link.  The consumer waits on a pipe when the queue is empty,
+ * which producers write to only if it does.
+ */
 typedef struct {
-    char filename[512];
-    off_t offset; /* for support Range */
-    size_t end;
-} http_request_t;
+    _Atomic(conn_node_t *) head; /* Last node pushed */
+    conn_node_t *tail;           /* Next node popped, owned by the consumer */
+    conn_node_t stub;            /* Keeps the list non-empty */
+    atomic_bool sleeping;        /* The consumer waits on wake[0] */
+    int wake[2];                 /* Pipe waking the consumer */
+} conn_queue_t;
+
+struct __web_worker;
+
+/* Requests are accepted, read, parsed and answered by a pool of worker
+ * threads, each serving the connections it accepted.  Commands still run
+ * one at a time on the console thread, the interpreter.  A connection with
+ * a command to run is handed to it through a queue, then back to its
+ * worker once the output is in.  Whoever holds the connection at the time
+ * owns cmd and out, while the worker keeps reading input into rio.
+ */
+typedef struct __web_conn {
+    conn_node_t node;                 /* Link in a hand-off queue */
+    struct __web_worker *worker;      /* Thread serving the connection */
+    rio_t rio;                        /* Requests received */
+    conn_state_t state;
+    int events;                       /* Events polled for, 0 if none */
+    bool in_request;                  /* Request line parsed, not headers */
+    bool keep_alive;                  /* Serve another request once done */
+    bool eof;                         /* The client sends no more */
+    bool http11;                      /* The request is HTTP/1.1 */
+    bool post;                        /* The request has a batch body */
+    bool has_length;                  /* The request gives its length */
+    bool unsupported;                 /* The request has a chunked body */
+    bool expect;                      /* The client waits for 100 Continue */
+    bool batch;                       /* Running the body of a request */
+    bool broken;                      /* Out of memory for the response */
+    size_t req_len;                   /* Bytes parsed of the request */
+    size_t body_left;                 /* Bytes of the body not parsed */
+    char *out;                        /* Responses to send */
+    size_t out_len, out_size;         /* Bytes in and size of out */
+    size_t sent;                      /* Bytes of out sent */
+    size_t resp_start;                /* Offset of the running command's
+                                         output in out */
+    char cmd[CMDSIZE];                /* Command to run */
+} web_conn_t;
+
+/* What parsing the input of a connection came up with */
+typedef enum {
+    PARSE_MORE,  /* Need more input */
+    PARSE_CMD,   /* A command to run */
+    PARSE_REPLY, /* A response to send, without a command */
+} parse_t;
+
+typedef struct __web_worker {
+    pthread_t thread;
+    conn_queue_t done;  /* Connections whose command has run */
+    bool listen_paused; /* Not watching the listening socket */
+#ifdef __linux__
+    int epoll_fd;
+#else
+    struct pollfd *pfds;
+    void **pdata;
+    size_t npfds, pfds_size;
+#endif
+} web_worker_t;
+
+static int listen_fd = -1;
+
+static web_worker_t workers[WORKERS_MAX];
+static int nworkers;
 
-static void rio_readinitb(rio_t *rp, int fd)
+/* Connections whose commands wait to run, in order of arrival */
+static conn_queue_t ready;
+
+/* Connection of the command being run, receiving its output */
+static web_conn_t *running;
+
+/* Tags telling the listening socket and the wake-up pipe apart from
+ * connections in poller events
+ */
+static char listen_tag, wake_tag;
+
+static bool set_nonblocking(int fd)
+{
+    int flags = fcntl(fd, F_GETFL, 0);
+    return flags >= 0 && fcntl(fd, F_SETFL, flags | O_NONBLOCK) >= 0;
+}
+
+static bool connq_init(conn_queue_t *q)
 {
-    rp->fd = fd;
-    rp->count = 0;
-    rp->bufptr = rp->buf;
+    atomic_init(&q->stub.next, NULL);
+    atomic_init(&q->head, &q->stub);
+    q->tail = &q->stub;
+    atomic_init(&q->sleeping, false);
+    if (pipe(q->wake) < 0)
+        return false;
+    if (!set_nonblocking(q->wake[0]) || !set_nonblocking(q->wake[1])) {
+        close(q->wake[0]);
+        close(q->wake[1]);
+        return false;
+    }
+    return true;
+}
+
+static void connq_link(conn_queue_t *q, conn_node_t *node)
+{
+    atomic_store_explicit(&node->next, NULL, memory_order_relaxed);
+    conn_node_t *prev = atomic_exchange(&q->head, node);
+    /* Until this store, the consumer sees the queue end at prev */
+    atomic_store_explicit(&prev->next, node, memory_order_release);
 }
 
-/* This is a wrapper for the Unix read() function that transfers min(n, count)
- * bytes from an internal buffer to a user buffer, where n is the number of
- * bytes requested by the user and count is the number of unread bytes in the
- * internal buffer. On entry, rio_read() refills the internal buffer via a call
- * to read() if the internal buffer is empty.
+static void connq_push(conn_queue_t *q, web_conn_t *c)
+{
+    connq_link(q, &c->node);
+    if (atomic_exchange(&q->sleeping, false)) {
+        char b = 0;
+        /* A full pipe wakes the consumer all the same */
+        ssize_t n = write(q->wake[1], &b, 1);
+        (void) n;
+    }
+}
+
+/* Oldest connection of q, NULL if there is none or if the push of the next
+ * one is half done
  */
-/* $begin rio_read */
-static ssize_t rio_read(rio_t *rp, char *usrbuf, size_t n)
-{
-    int cnt;
-    while (rp->count <= 0) { /* refill if buf is empty */
-        rp->count = read(rp->fd, rp->buf, sizeof(rp->buf));
-        if (rp->count < 0) {
-            if (errno != EINTR) /* interrupted by sig handler return */
-                return -1;
-        } else if (rp->count == 0) { /* EOF */
-            return 0;
-        } else
-            rp->bufptr = rp->buf; /* reset buffer ptr */
-    }
-
-    /* Copy min(n, rp->count) bytes from internal buf to user buf */
-    cnt = n;
-    if (rp->count < n)
-        cnt = rp->count;
-    memcpy(usrbuf, rp->bufptr, cnt);
-    rp->bufptr += cnt;
-    rp->count -= cnt;
-    return cnt;
-}
-
-static ssize_t writen(int fd, void *usrbuf, size_t n)
-{
-    size_t nleft = n;
-    char *bufp = usrbuf;
-
-    while (nleft > 0) {
-        ssize_t nwritten = write(fd, bufp, nleft);
-        if (nwritten <= 0) {
-            if (errno == EINTR) { /* interrupted by sig handler return */
-                nwritten = 0;     /* and call write() again */
-            } else
-                return -1; /* errorno set by write() */
-        }
-        nleft -= nwritten;
-        bufp += nwritten;
+static web_conn_t *connq_pop(conn_queue_t *q)
+{
+    conn_node_t *tail = q->tail;
+    conn_node_t *next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    if (tail == &q->stub) {
+        if (!next)
+            return NULL;
+        q->tail = tail = next;
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+    }
+    if (!next) {
+        /* The last node leaves once the stub takes its place */
+        if (tail != atomic_load(&q->head))
+            return NULL;
+        connq_link(q, &q->stub);
+        next = atomic_load_explicit(&tail->next, memory_order_acquire);
+        if (!next)
+            return NULL;
+    }
+    q->tail = next;
+    return container_of(tail, web_conn_t, node);
+}
+
+/* Whether q holds no connection, even one half pushed */
+static bool connq_empty(conn_queue_t *q)
+{
+    return q->tail == &q->stub && atomic_load(&q->head) == &q->stub;
+}
+
+/* Tell producers that the consumer of q is about to wait for its pipe.
+ * Return false if it must not, as q is not empty.  Either the consumer
+ * sees a push here, or the producer sees the flag and writes to the pipe.
+ */
+static bool connq_sleep(conn_queue_t *q)
+{
+    atomic_store(&q->sleeping, true);
+    if (connq_empty(q))
+        return true;
+    atomic_store(&q->sleeping, false);
+    return false;
+}
+
+/* Back from waiting, emptying the pipe if it was written to */
+static void connq_awake(conn_queue_t *q, bool woken)
+{
+    atomic_store(&q->sleeping, false);
+    char buf[64];
+    while (woken && read(q->wake[0], buf, sizeof(buf)) > 0)
+        ;
+}
+
+/* Readiness notification, a poller per worker.  Linux has epoll, which
+ * costs the same however many connections sit idle.  Elsewhere, poll()
+ * does the job for the few clients a console has.
+ */
+#define WEB_IN 1
+#define WEB_OUT 2
+#define WEB_EXCL 4 /* Wake a single worker for the shared listening socket */
+
+typedef struct {
+    void *data;
+    int events;
+} web_event_t;
+
+#ifdef __linux__
+#ifndef EPOLLEXCLUSIVE
+#define EPOLLEXCLUSIVE 0
+#endif
+
+static bool poller_init(web_worker_t *w)
+{
+    w->epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    return w->epoll_fd >= 0;
+}
+
+static void poller_free(web_worker_t *w)
+{
+    close(w->epoll_fd);
+}
+
+static int poller_ctl(web_worker_t *w, int op, int fd, int events, void *data)
+{
+    struct epoll_event ev = {
+        .events = (events & WEB_IN ? EPOLLIN : 0) |
+                  (events & WEB_OUT ? EPOLLOUT : 0) |
+                  (events & WEB_EXCL ? EPOLLEXCLUSIVE : 0),
+        .data.ptr = data,
+    };
+    return epoll_ctl(w->epoll_fd, op, fd, &ev);
+}
+
+static int poller_add(web_worker_t *w, int fd, int events, void *data)
+{
+    return poller_ctl(w, EPOLL_CTL_ADD, fd, events, data);
+}
+
+static int poller_mod(web_worker_t *w, int fd, int events, void *data)
+{
+    return poller_ctl(w, EPOLL_CTL_MOD, fd, events, data);
+}
+
+static void poller_del(web_worker_t *w, int fd)
+{
+    poller_ctl(w, EPOLL_CTL_DEL, fd, 0, NULL);
+}
+
+static int poller_wait(web_worker_t *w, web_event_t *evs, int timeout)
+{
+    struct epoll_event ev[MAX_EVENTS];
+    int n = epoll_wait(w->epoll_fd, ev, MAX_EVENTS, timeout);
+    for (int i = 0; i < n; i++) {
+        evs[i].data = ev[i].data.ptr;
+        /* Errors and hangups show up on the next read or write */
+        evs[i].events = (ev[i].events & (EPOLLIN | EPOLLERR | EPOLLHUP)
+                             ? WEB_IN
+                             : 0) |
+                        (ev[i].events & (EPOLLOUT | EPOLLERR | EPOLLHUP)
+                             ? WEB_OUT
+                             : 0);
     }
     return n;
 }
+#else
+static bool poller_init(web_worker_t *w)
+{
+    w->pfds = NULL;
+    w->pdata = NULL;
+    w->npfds = w->pfds_size = 0;
+    return true;
+}
+
+static void poller_free(web_worker_t *w)
+{
+    free(w->pfds);
+    free(w->pdata);
+}
+
+static int poller_find(web_worker_t *w, int fd)
+{
+    for (size_t i = 0; i < w->npfds; i++) {
+        if (w->pfds[i].fd == fd)
+            return i;
+    }
+    return -1;
+}
+
+static int poller_add(web_worker_t *w, int fd, int events, void *data)
+{
+    if (w->npfds == w->pfds_size) {
+        size_t size = w->pfds_size ? 2 * w->pfds_size : 64;
+        struct pollfd *p = realloc(w->pfds, size * sizeof(*p));
+        if (!p)
+            return -1;
+        w->pfds = p;
+        void **d = realloc(w->pdata, size * sizeof(*d));
+        if (!d)
+            return -1;
+        w->pdata = d;
+        w->pfds_size = size;
+    }
+    w->pfds[w->npfds].fd = fd;
+    w->pfds[w->npfds].events =
+        (events & WEB_IN ? POLLIN : 0) | (events & WEB_OUT ? POLLOUT : 0);
+    w->pdata[w->npfds++] = data;
+    return 0;
+}
+
+static int poller_mod(web_worker_t *w, int fd, int events, void *data)
+{
+    int i = poller_find(w, fd);
+    if (i < 0)
+        return -1;
+    w->pfds[i].events =
+        (events & WEB_IN ? POLLIN : 0) | (events & WEB_OUT ? POLLOUT : 0);
+    w->pdata[i] = data;
+    return 0;
+}
 
-/* robustly read a text line (buffered) */
-static ssize_t rio_readlineb(rio_t *rp, void *usrbuf, size_t maxlen)
+static void poller_del(web_worker_t *w, int fd)
 {
-    char c, *bufp = usrbuf;
+    int i = poller_find(w, fd);
+    if (i < 0)
+        return;
+    w->pfds[i] = w->pfds[--w->npfds];
+    w->pdata[i] = w->pdata[w->npfds];
+}
 
-    int n;
-    for (n = 1; n < maxlen; n++) {
-        int rc;
-        if ((rc = rio_read(rp, &c, 1)) == 1) {
-            *bufp++ = c;
-            if (c == '\n')
-                break;
-        } else if (rc == 0) {
-            if (n == 1)
-                return 0; /* EOF, no data read */
-            break;        /* EOF, some data was read */
-        } else
-            return -1; /* error */
+static int poller_wait(web_worker_t *w, web_event_t *evs, int timeout)
+{
+    int n = poll(w->pfds, w->npfds, timeout);
+    if (n <= 0)
+        return n;
+
+    n = 0;
+    for (size_t i = 0; i < w->npfds && n < MAX_EVENTS; i++) {
+        short r = w->pfds[i].revents;
+        if (!r)
+            continue;
+        evs[n].data = w->pdata[i];
+        evs[n++].events = (r & (POLLIN | POLLERR | POLLHUP) ? WEB_IN : 0) |
+                          (r & (POLLOUT | POLLERR | POLLHUP) ? WEB_OUT : 0);
     }
-    *bufp = 0;
     return n;
 }
+#endif
+
+static void *worker_main(void *arg);
+
+/* Watch the listening socket from w */
+static int listen_watch(web_worker_t *w)
+{
+    /* Fall back to waking every worker on kernels without EPOLLEXCLUSIVE */
+    if (poller_add(w, listen_fd, WEB_IN | WEB_EXCL, &listen_tag) < 0 &&
+        poller_add(w, listen_fd, WEB_IN, &listen_tag) < 0)
+        return -1;
+    w->listen_paused = false;
+    return 0;
+}
 
-void web_send(int out_fd, char *buf)
+static bool worker_start(web_worker_t *w)
 {
-    writen(out_fd, buf, strlen(buf));
+    if (!poller_init(w))
+        return false;
+    if (!connq_init(&w->done)) {
+        poller_free(w);
+        return false;
+    }
+    if (poller_add(w, w->done.wake[0], WEB_IN, &wake_tag) < 0 ||
+        listen_watch(w) < 0 ||
+        pthread_create(&w->thread, NULL, worker_main, w)) {
+        close(w->done.wake[0]);
+        close(w->done.wake[1]);
+        poller_free(w);
+        return false;
+    }
+    return true;
 }
 
-int web_open(int port)
+int web_open(int port, int nthreads)
 {
     int listenfd, optval = 1;
     struct sockaddr_in serveraddr;
 
+    if (listen_fd >= 0) {
+        errno = EALREADY;
+        return -1;
+    }
+
+    /* A closed client must not kill the console with SIGPIPE */
+    signal(SIGPIPE, SIG_IGN);
+
+    /* Every connection takes a descriptor, so allow as many as we may */
+    struct rlimit rl;
+    if (getrlimit(RLIMIT_NOFILE, &rl) == 0 && rl.rlim_cur < rl.rlim_max) {
+        rl.rlim_cur = rl.rlim_max;
+        setrlimit(RLIMIT_NOFILE, &rl);
+    }
+
+    if (nthreads <= 0) {
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        nthreads = n < 1 ? 1 : n;
+    }
+    if (nthreads > WORKERS_MAX)
+        nthreads = WORKERS_MAX;
+
     /* Create a socket descriptor */
     if ((listenfd = socket(AF_INET, SOCK_STREAM, 0)) < 0)
         return -1;
@@ -133,13 +464,7 @@ int web_open(int port)
     /* Eliminates "Address already in use" error from bind. */
     if (setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, (const void *) &optval,
                    sizeof(int)) < 0)
-        return -1;
-
-    // 6 is TCP's protocol number
-    // enable this, much faster : 4000 req/s -> 17000 req/s
-    if (setsockopt(listenfd, IPPROTO_TCP, TCP_CORK, (const void *) &optval,
-                   sizeof(int)) < 0)
-        return -1;
+        goto fail;
 
     /* Listenfd will be an endpoint for all requests to port
        on any IP address for this host */
@@ -148,12 +473,33 @@ int web_open(int port)
     serveraddr.sin_addr.s_addr = htonl(INADDR_ANY);
     serveraddr.sin_port = htons((unsigned short) port);
     if (bind(listenfd, (struct sockaddr *) &serveraddr, sizeof(serveraddr)) < 0)
-        return -1;
+        goto fail;
 
     /* Make it a listening socket ready to accept connection requests */
-    if (listen(listenfd, LISTENQ) < 0)
-        return -1;
-    return listenfd;
+    if (listen(listenfd, LISTENQ) < 0 || !set_nonblocking(listenfd) ||
+        !connq_init(&ready))
+        goto fail;
+    listen_fd = listenfd;
+
+    /* Workers inherit a mask blocking every signal, which are the
+     * console's business
+     */
+    sigset_t all, old;
+    sigfillset(&all);
+    pthread_sigmask(SIG_SETMASK, &all, &old);
+    while (nworkers < nthreads && worker_start(&workers[nworkers]))
+        nworkers++;
+    pthread_sigmask(SIG_SETMASK, &old, NULL);
+
+    if (nworkers)
+        return listenfd;
+    listen_fd = -1;
+    close(ready.wake[0]);
+    close(ready.wake[1]);
+
+fail:
+    close(listenfd);
+    return -1;
 }
 
 static void url_decode(char *src, char *dest, int max)
@@ -172,27 +518,11 @@ static void url_decode(char *src, char *dest, int max)
     *dest = '\0';
 }
 
-static void parse_request(int fd, http_request_t *req)
-{
-    rio_t rio;
-    char buf[MAXLINE], method[MAXLINE], uri[MAXLINE];
-    req->offset = 0;
-    req->end = 0; /* default */
-
-    rio_readinitb(&rio, fd);
-    rio_readlineb(&rio, buf, MAXLINE);
-    sscanf(buf, "%1023s %1023s", method, uri); /* version is not cared */
-    /* read all */
-    while (buf[0] != '\n' && buf[1] != '\n') { /* \n || \r\n */
-        rio_readlineb(&rio, buf, MAXLINE);
-        if (buf[0] == 'R' && buf[1] == 'a' && buf[2] == 'n') {
-            sscanf(buf, "Range: bytes=%lu-%lu", (unsigned long *) &req->offset,
-                   (unsigned long *) &req->end);
-            /* Range: [start, end] */
-            if (req->end != 0)
-                req->end++;
-        }
-    }
+/* Turn the URI of a request into a command: the path without its leading
+ * '/' and query string, decoded, with '/' separating the arguments
+ */
+static void uri_to_cmd(char *uri, char *cmd)
+{
     char *filename = uri;
     if (uri[0] == '/') {
         filename = uri + 1;
@@ -208,23 +538,474 @@ static void parse_request(int fd, http_request_t *req)
             }
         }
     }
-    url_decode(filename, req->filename, MAXLINE);
-}
+    url_decode(filename, cmd, MAXLINE);
 
-char *web_recv(int fd, struct sockaddr_in *clientaddr)
-{
-    http_request_t req;
-    parse_request(fd, &req);
-
-    char *p = req.filename;
+    char *p = cmd;
     /* Change '/' to ' ' */
     while (*p) {
         ++p;
         if (*p == '/')
             *p = ' ';
     }
-    char *ret = malloc(strlen(req.filename) + 1);
-    strncpy(ret, req.filename, strlen(req.filename) + 1);
+}
+
+/* Copy a line to buf of size bytes without its end of line, cut to fit */
+static void copy_line(char *buf, size_t size, const char *line, size_t len)
+{
+    if (len && line[len - 1] == '\n')
+        len--;
+    if (len && line[len - 1] == '\r')
+        len--;
+    if (len >= size)
+        len = size - 1;
+    memcpy(buf, line, len);
+    buf[len] = '\0';
+}
+
+/* Make room for len more bytes of output */
+static bool out_reserve(web_conn_t *c, size_t len)
+{
+    if (c->out_len + len <= c->out_size)
+        return true;
+
+    size_t size = c->out_size ? c->out_size : 256;
+    while (size < c->out_len + len)
+        size *= 2;
+    char *out = realloc(c->out, size);
+    if (!out)
+        return false;
+    c->out = out;
+    c->out_size = size;
+    return true;
+}
+
+/* Insert len bytes of buf into the output at offset pos */
+static bool out_insert(web_conn_t *c, size_t pos, const char *buf, size_t len)
+{
+    if (!out_reserve(c, len))
+        return false;
+    memmove(c->out + pos + len, c->out + pos, c->out_len - pos);
+    memcpy(c->out + pos, buf, len);
+    c->out_len += len;
+    return true;
+}
+
+static bool out_append(web_conn_t *c, const char *buf)
+{
+    return out_insert(c, c->out_len, buf, strlen(buf));
+}
+
+/* Answer a request we do not serve, then hang up */
+static parse_t conn_reply(web_conn_t *c, const char *status)
+{
+    char head[128];
+    snprintf(head, sizeof(head),
+             "HTTP/1.1 %s\r\n"
+             "Content-Length: 0\r\n"
+             "Connection: close\r\n\r\n",
+             status);
+    c->keep_alive = false;
+    out_append(c, head);
+    return PARSE_REPLY;
+}
+
+/* Take the next command from the body of a batch, skipping blank lines */
+static parse_t parse_body(web_conn_t *c)
+{
+    char *line;
+    size_t len;
+    while (c->body_left) {
+        /* Lines too long for cmd are cut, the rest makes another line */
+        size_t max = c->body_left < CMDSIZE - 2 ? c->body_left : CMDSIZE - 2;
+        if (!(line = rio_getline(&c->rio, max, &len)))
+            return PARSE_MORE;
+        c->body_left -= len;
+        copy_line(c->cmd, CMDSIZE, line, len);
+        if (c->cmd[strspn(c->cmd, " \t")])
+            return PARSE_CMD;
+    }
+
+    /* End of the batch, and of its response */
+    c->batch = false;
+    if (c->http11)
+        out_append(c, "0\r\n\r\n");
+    return PARSE_REPLY;
+}
+
+/* Start the response to a batch, whose commands follow */
+static parse_t start_batch(web_conn_t *c)
+{
+    if (c->unsupported)
+        return conn_reply(c, "501 Not Implemented");
+    if (!c->has_length)
+        return conn_reply(c, "411 Length Required");
+
+    /* An HTTP/1.0 client reads the response until the connection closes */
+    if (!c->http11)
+        c->keep_alive = false;
+    char head[192];
+    snprintf(head, sizeof(head),
+             "%sHTTP/1.1 200 OK\r\n"
+             "Content-Type: text/plain\r\n"
+             "%s%s\r\n",
+             c->expect ? "HTTP/1.1 100 Continue\r\n\r\n" : "",
+             c->http11 ? "Transfer-Encoding: chunked\r\n" : "",
+             c->keep_alive ? "" : "Connection: close\r\n");
+    if (!out_append(c, head))
+        return conn_reply(c, "500 Internal Server Error");
+    c->batch = true;
+    return parse_body(c);
+}
+
+/* Parse the lines of the request of c received so far */
+static parse_t parse_request(web_conn_t *c)
+{
+    char buf[MAXLINE], method[MAXLINE], uri[MAXLINE], version[MAXLINE];
+    char *line;
+    size_t len;
+    while ((line = rio_getline(&c->rio, 0, &len))) {
+        c->req_len += len;
+        copy_line(buf, MAXLINE, line, len);
+
+        if (!c->in_request) {
+            /* Request line, after any empty lines */
+            if (!*buf)
+                continue;
+            version[0] = '\0';
+            if (sscanf(buf, "%1023s %1023s %1023s", method, uri, version) < 2)
+                strcpy(uri, "/");
+            /* HTTP/1.1 keeps the connection by default, HTTP/1.0 does not */
+            c->http11 = strcmp(version, "HTTP/1.0") && *version;
+            c->keep_alive = c->http11;
+            c->post = !strcasecmp(method, "POST");
+            c->has_length = c->unsupported = c->expect = false;
+            c->body_left = 0;
+            uri_to_cmd(uri, c->cmd);
+            c->in_request = true;
+        } else if (!*buf) {
+            /* Headers end with an empty line */
+            c->in_request = false;
+            c->req_len = 0;
+            if (c->post)
+                return start_batch(c);
+            /* Any other body would be taken for the next request */
+            if (c->body_left || c->unsupported)
+                return conn_reply(c, "400 Bad Request");
+            return PARSE_CMD;
+        } else if (!strncasecmp(buf, "Connection:", 11)) {
+            const char *v = buf + 11 + strspn(buf + 11, " \t");
+            if (!strncasecmp(v, "close", 5))
+                c->keep_alive = false;
+            else if (!strncasecmp(v, "keep-alive", 10))
+                c->keep_alive = true;
+        } else if (!strncasecmp(buf, "Content-Length:", 15)) {
+            c->has_length = true;
+            c->body_left = strtoull(buf + 15, NULL, 10);
+        } else if (!strncasecmp(buf, "Transfer-Encoding:", 18)) {
+            c->unsupported = true;
+        } else if (!strncasecmp(buf, "Expect:", 7)) {
+            c->expect = true;
+        }
+    }
+    return PARSE_MORE;
+}
+
+/* Poll c for events, or for none if 0 */
+static int conn_watch(web_conn_t *c, int events)
+{
+    int r = 0;
+    if (events == c->events)
+        return 0;
+    if (!events)
+        poller_del(c->worker, c->rio.fd);
+    else if (!c->events)
+        r = poller_add(c->worker, c->rio.fd, events, c);
+    else
+        r = poller_mod(c->worker, c->rio.fd, events, c);
+    if (r == 0)
+        c->events = events;
+    return r;
+}
+
+static void conn_close(web_conn_t *c)
+{
+    web_worker_t *w = c->worker;
+    conn_watch(c, 0);
+    close(c->rio.fd);
+    rio_free(&c->rio);
+    free(c->out);
+    free(c);
+
+    /* The descriptor is free for the next connection */
+    if (w->listen_paused)
+        listen_watch(w);
+}
+
+/* Hand the next command of c to the interpreter, if all of it is there */
+static parse_t conn_parse(web_conn_t *c)
+{
+    parse_t r = c->batch ? parse_body(c) : parse_request(c);
+    if (r == PARSE_CMD) {
+        c->state = CONN_PENDING;
+        connq_push(&ready, c);
+    }
+    return r;
+}
+
+static void conn_write(web_conn_t *c);
+
+static void conn_read(web_conn_t *c)
+{
+    bool full = false;
+    while (!c->eof && !full) {
+        ssize_t n = rio_fill(&c->rio);
+        if (n > 0) {
+            /* Requests after a pending one wait for its response */
+            if (c->state == CONN_READING && conn_parse(c) == PARSE_REPLY) {
+                conn_write(c);
+                return;
+            }
+        } else if (n < 0 && errno == ENOBUFS) {
+            full = true;
+        } else if (n < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+            break;
+        } else {
+            c->eof = true;
+        }
+    }
+
+    if (c->state != CONN_READING) {
+        /* Nothing to read until the command is done, so do not spin on a
+         * connection that stays readable meanwhile
+         */
+        if (c->eof || full)
+            conn_watch(c, 0);
+        return;
+    }
+    /* Gone, or sending a request larger than we take */
+    if (c->eof || full ||
+        (!c->batch && c->req_len + rio_unread(&c->rio) > REQ_MAX))
+        conn_close(c);
+    /* Start the response of a batch before its body comes in */
+    else if (c->out_len)
+        conn_write(c);
+}
+
+/* Send the responses of c, then serve its next request or hang up */
+static void conn_write(web_conn_t *c)
+{
+    for (;;) {
+        while (c->sent < c->out_len) {
+            ssize_t n =
+                write(c->rio.fd, c->out + c->sent, c->out_len - c->sent);
+            if (n < 0) {
+                if (errno == EINTR)
+                    continue;
+                if (errno == EAGAIN || errno == EWOULDBLOCK) {
+                    /* Stop reading until the client makes room */
+                    if (conn_watch(c, WEB_OUT) < 0)
+                        conn_close(c);
+                    else
+                        c->state = CONN_WRITING;
+                    return;
+                }
+                conn_close(c);
+                return;
+            }
+            c->sent += n;
+        }
+
+        if (conn_watch(c, c->eof ? 0 : WEB_IN) < 0) {
+            conn_close(c);
+            return;
+        }
+        c->out_len = c->sent = 0;
+        if (c->out_size > OUT_KEEP) {
+            free(c->out);
+            c->out = NULL;
+            c->out_size = 0;
+        }
+
+        c->state = CONN_READING;
+        if (!c->keep_alive && !c->batch) {
+            conn_close(c);
+            return;
+        }
+        parse_t r = conn_parse(c);
+        if (r == PARSE_REPLY)
+            continue;
+        if (r == PARSE_MORE && c->eof)
+            conn_close(c);
+        return;
+    }
+}
+
+/* Take back c from the interpreter, which ran its command */
+static void conn_done(web_conn_t *c)
+{
+    if (c->broken) {
+        conn_close(c);
+        return;
+    }
+
+    /* Answer the requests that came in together with a single write */
+    if (c->out_len < OUT_KEEP && (c->keep_alive || c->batch) &&
+        conn_parse(c) == PARSE_CMD)
+        return;
+    conn_write(c);
+}
+
+static void web_accept(web_worker_t *w)
+{
+    /* Leave the rest of a burst of connections to other workers */
+    for (int i = 0; i < ACCEPT_MAX; i++) {
+        int fd = accept(listen_fd, NULL, NULL);
+        if (fd < 0) {
+            if (errno == EINTR || errno == ECONNABORTED)
+                continue;
+            /* Out of descriptors, the pending connection keeps the socket
+             * readable, so stop watching it until a connection closes or
+             * ACCEPT_RETRY ms pass rather than spin
+             */
+            if (errno == EMFILE || errno == ENFILE || errno == ENOBUFS ||
+                errno == ENOMEM) {
+                poller_del(w, listen_fd);
+                w->listen_paused = true;
+            }
+            return;
+        }
+
+        int optval = 1;
+        web_conn_t *c = malloc(sizeof(web_conn_t));
+        if (!c || !set_nonblocking(fd) ||
+            setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &optval, sizeof(int)) <
+                0 ||
+            !rio_init(&c->rio, fd, BUFSIZE, REQ_MAX)) {
+            free(c);
+            close(fd);
+            continue;
+        }
+        c->worker = w;
+        c->state = CONN_READING;
+        c->events = 0;
+        c->in_request = false;
+        c->batch = false;
+        c->eof = false;
+        c->broken = false;
+        c->req_len = 0;
+        c->out = NULL;
+        c->out_len = c->sent = 0;
+        c->out_size = 0;
+        if (conn_watch(c, WEB_IN) < 0) {
+            rio_free(&c->rio);
+            free(c);
+            close(fd);
+        }
+    }
+}
+
+static void *worker_main(void *arg)
+{
+    web_worker_t *w = arg;
+    web_event_t evs[MAX_EVENTS];
+
+    for (;;) {
+        int timeout = 0;
+        if (connq_sleep(&w->done))
+            timeout = w->listen_paused ? ACCEPT_RETRY : -1;
+        int n = poller_wait(w, evs, timeout);
+        if (w->listen_paused)
+            listen_watch(w);
+        bool woken = false;
+        for (int i = 0; i < n; i++) {
+            if (evs[i].data == &wake_tag) {
+                woken = true;
+            } else if (evs[i].data == &listen_tag) {
+                web_accept(w);
+            } else {
+                web_conn_t *c = evs[i].data;
+                if (c->state == CONN_WRITING) {
+                    if (evs[i].events & WEB_OUT)
+                        conn_write(c);
+                } else if (evs[i].events & WEB_IN) {
+                    conn_read(c);
+                }
+            }
+        }
+        connq_awake(&w->done, woken);
+
+        web_conn_t *c;
+        while ((c = connq_pop(&w->done)))
+            conn_done(c);
+    }
+    return NULL;
+}
+
+bool web_poll(int infd, int timeout)
+{
+    /* poll() ignores a negative descriptor, and finds regular files, which
+     * never block, always ready
+     */
+    struct pollfd pfds[2] = {
+        {.fd = ready.wake[0], .events = POLLIN},
+        {.fd = infd, .events = POLLIN},
+    };
+    if (!connq_sleep(&ready))
+        timeout = 0;
+    int n = poll(pfds, 2, timeout);
+    connq_awake(&ready, n > 0 && pfds[0].revents);
+    return n > 0 && pfds[1].revents;
+}
+
+char *web_next_cmd(void)
+{
+    web_conn_t *c = connq_pop(&ready);
+    if (!c)
+        return NULL;
+
+    c->resp_start = c->out_len;
+    running = c;
+    return c->cmd;
+}
+
+void web_output(const char *buf, size_t len)
+{
+    web_conn_t *c = running;
+    /* Better a truncated response than none */
+    if (!c || !out_reserve(c, len))
+        return;
+
+    memcpy(c->out + c->out_len, buf, len);
+    c->out_len += len;
+}
+
+void web_finish(void)
+{
+    web_conn_t *c = running;
+    if (!c)
+        return;
+
+    running = NULL;
+    char head[128];
+    size_t body = c->out_len - c->resp_start;
+    int head_len;
+    if (!c->batch) {
+        head_len = snprintf(head, sizeof(head),
+                            "HTTP/1.1 200 OK\r\n"
+                            "Content-Type: text/plain\r\n"
+                            "Content-Length: %zu\r\n"
+                            "%s\r\n",
+                            body, c->keep_alive ? "" : "Connection: close\r\n");
+    } else if (c->http11 && body) {
+        /* The output of each command of a batch makes a chunk */
+        head_len = snprintf(head, sizeof(head), "%zx\r\n", body);
+    } else {
+        head_len = 0;
+    }
+    if (!out_insert(c, c->resp_start, head, head_len) ||
+        (c->batch && c->http11 && body && !out_append(c, "\r\n")))
+        c->broken = true;
 
-    return ret;
+    /* Its worker sends the response and parses the next request */
+    connq_push(&c->worker->done, c);
 }
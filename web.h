@@ -1,12 +1,36 @@
 #ifndef TINYWEB_H
 #define TINYWEB_H
 
-#include <netinet/in.h>
+#include <stdbool.h>
+#include <stddef.h>
 
-int web_open(int port);
+/* Start serving HTTP requests on port.  A GET request carries a command in
+ * its path, e.g. GET /it/hello for "it hello".  A POST request carries a
+ * command per line of its body, like a .cmd file, and gets their output in
+ * a chunked response.  Connections are kept open between requests and never
+ * block the console.  They are served by nthreads worker threads, or one per
+ * processor if nthreads is not positive, up to 8, which leave the console
+ * thread nothing but running commands.  Return the listening socket, or -1
+ * on failure.
+ */
+int web_open(int port, int nthreads);
 
-char *web_recv(int fd, struct sockaddr_in *clientaddr);
+/* Wait up to timeout milliseconds, or for ever if timeout is negative, for
+ * input on infd or for a command from the network.  infd is not watched if
+ * negative.  Return true if infd is ready.
+ */
+bool web_poll(int infd, int timeout);
 
-void web_send(int out_fd, char *buffer);
+/* Command of the oldest request received, NULL if there is none.  Commands
+ * run one at a time: the output of this one, given to web_output(), makes up
+ * the response sent when web_finish() is called.
+ */
+char *web_next_cmd(void);
+
+/* Add len bytes of buf to the output of the running command, if any */
+void web_output(const char *buf, size_t len);
+
+/* Send the response of the running command */
+void web_finish(void);
 
 #endif